@@ -3,6 +3,8 @@
 
 #include "../src/image_io.cpp"
 #include "../src/image_processing.cpp"
+#include "image_compare.h"
+#include "sequence_player.h"
 
 namespace py = pybind11;
 
@@ -17,7 +19,20 @@ PYBIND11_MODULE(hdr_viewer_cpp, m) {
         .def_readwrite("dynamic_range", &DynamicRangeData::dynamic_range)
         .def_readwrite("stops", &DynamicRangeData::stops);
 
-    py::class_<ImageData>(m, "ImageData")
+    py::class_<PlanarImage>(m, "PlanarImage")
+        .def_readonly("width", &PlanarImage::width)
+        .def_readonly("height", &PlanarImage::height)
+        .def_readonly("channels", &PlanarImage::channels)
+        .def_readonly("stride", &PlanarImage::stride)
+        .def("interleaved", &to_interleaved,
+             "Copy of the pixels in interleaved order");
+    m.def("to_planar", &to_planar, "Planar copy of interleaved pixels",
+          py::arg("pixels"), py::arg("width"), py::arg("height"),
+          py::arg("channels"));
+
+    // Shared holder: playback frames are shared between the ring buffer and
+    // Python
+    py::class_<ImageData, std::shared_ptr<ImageData>>(m, "ImageData")
         .def(py::init<>())  // If you have a default constructor
         .def_readwrite("pixels", &ImageData::pixels)
         .def_readwrite("original_width", &ImageData::original_width)
@@ -34,7 +49,20 @@ PYBIND11_MODULE(hdr_viewer_cpp, m) {
             [](const ImageData& self) -> const DynamicRangeData* {
                 return self.dynamic_range_data.get();
             })
-        .def("hasDynamicRangeData", &ImageData::hasDynamicRangeData);
+        .def("hasDynamicRangeData", &ImageData::hasDynamicRangeData)
+        .def_readonly("planar", &ImageData::planar)
+        .def("is_planar", &ImageData::is_planar);
+
+    py::class_<ScopeData>(m, "ScopeData")
+        .def(py::init<>())
+        .def_readonly("luma_histogram", &ScopeData::luma_histogram)
+        .def_readonly("rgb_histogram", &ScopeData::rgb_histogram)
+        .def_readonly("waveform", &ScopeData::waveform)
+        .def_readonly("vectorscope", &ScopeData::vectorscope);
+    m.attr("HISTOGRAM_BINS") = HISTOGRAM_BINS;
+    m.attr("WAVEFORM_COLUMNS") = WAVEFORM_COLUMNS;
+    m.attr("WAVEFORM_LEVELS") = WAVEFORM_LEVELS;
+    m.attr("VECTORSCOPE_SIZE") = VECTORSCOPE_SIZE;
 
     py::class_<ImageProcessor>(m, "ImageProcessor")
         .def(py::init<>())  // Assuming there is a default constructor
@@ -47,13 +75,159 @@ PYBIND11_MODULE(hdr_viewer_cpp, m) {
              py::arg("pixels"), py::arg("exposure"))
         .def(
             "apply_exposure_gamma_correction",
-            &ImageProcessor::apply_exposure_gamma_correction,
+            py::overload_cast<std::vector<float>&, float, float>(
+                &ImageProcessor::apply_exposure_gamma_correction, py::const_),
             "A function to apply exposure and gamma correction to image pixels",
-            py::arg("pixels"), py::arg("exposure"), py::arg("inv_gamma"));
-    m.def("scanline_image", [](const std::string& source_path, int new_width) {
-        ImageData image_data = scanline_image(source_path, new_width);
-        return image_data;
-    });
+            py::arg("pixels"), py::arg("exposure"), py::arg("inv_gamma"))
+        .def("apply_exposure_gamma_correction",
+             py::overload_cast<PlanarImage&, float, float>(
+                 &ImageProcessor::apply_exposure_gamma_correction, py::const_),
+             "Apply exposure and gamma correction to a planar image in place",
+             py::arg("image"), py::arg("exposure"), py::arg("inv_gamma"))
+        .def(
+            "apply_exposure_gamma_scopes",
+            [](const ImageProcessor& self, std::vector<float> pixels,
+               int width, int height, int channels, float exposure,
+               float inv_gamma) {
+                ScopeData scopes = self.apply_exposure_gamma_scopes(
+                    pixels, width, height, channels, exposure, inv_gamma);
+                return py::make_tuple(pixels, scopes);
+            },
+            "Apply exposure and gamma correction and return the processed "
+            "pixels together with their histograms, waveform and vectorscope",
+            py::arg("pixels"), py::arg("width"), py::arg("height"),
+            py::arg("channels"), py::arg("exposure"), py::arg("inv_gamma"))
+        .def("apply_local_tone_mapping",
+             &ImageProcessor::apply_local_tone_mapping,
+             "A function to apply bilateral-grid local tone mapping to linear "
+             "image pixels",
+             py::arg("pixels"), py::arg("width"), py::arg("height"),
+             py::arg("channels"), py::arg("compression"), py::arg("detail"))
+        .def("apply_exposure_gamma_interleave",
+             &ImageProcessor::apply_exposure_gamma_interleave,
+             "Apply exposure and gamma correction to a planar image and "
+             "return the result as interleaved pixels",
+             py::arg("image"), py::arg("exposure"), py::arg("inv_gamma"))
+        .def("device_report", &ImageProcessor::device_report,
+             "OpenCL lanes used for processing and their measured throughput");
+    py::class_<ImageLayer>(m, "ImageLayer")
+        .def_readonly("subimage", &ImageLayer::subimage)
+        .def_readonly("part_name", &ImageLayer::part_name)
+        .def_readonly("name", &ImageLayer::name)
+        .def_readonly("first_channel", &ImageLayer::first_channel)
+        .def_readonly("channel_count", &ImageLayer::channel_count)
+        .def_readonly("channel_names", &ImageLayer::channel_names);
+
+    m.def("list_layers", &list_layers,
+          "Parts and layers of an image file, in file order",
+          py::arg("source_path"));
+
+    py::class_<ImageReader>(m, "ImageReader")
+        .def(py::init<const std::string&>(), py::arg("source_path"))
+        .def("is_open", &ImageReader::is_open)
+        .def("layers", &ImageReader::layers)
+        .def("load", &ImageReader::load,
+             "Load one layer (an index into layers()) from the open file",
+             py::arg("layer"), py::arg("new_width"),
+             py::arg("planar") = false);
+
+    m.def(
+        "scanline_image",
+        [](const std::string& source_path, int new_width, bool planar) {
+            ImageData image_data =
+                scanline_image(source_path, new_width, planar);
+            return image_data;
+        },
+        py::arg("source_path"), py::arg("new_width"),
+        py::arg("planar") = false);
+
+    py::class_<CompareOptions>(m, "CompareOptions")
+        .def(py::init<>())
+        .def_readwrite("pixel_threshold", &CompareOptions::pixel_threshold)
+        .def_readwrite("max_abs_limit", &CompareOptions::max_abs_limit)
+        .def_readwrite("fail_fraction", &CompareOptions::fail_fraction)
+        .def_readwrite("early_exit", &CompareOptions::early_exit)
+        .def_readwrite("build_mask", &CompareOptions::build_mask)
+        .def_readwrite("peak", &CompareOptions::peak)
+        .def_readwrite("strip_rows", &CompareOptions::strip_rows);
+
+    py::class_<CompareResult>(m, "CompareResult")
+        .def_readonly("passed", &CompareResult::passed)
+        .def_readonly("stopped_early", &CompareResult::stopped_early)
+        .def_readonly("error", &CompareResult::error)
+        .def_readonly("width", &CompareResult::width)
+        .def_readonly("height", &CompareResult::height)
+        .def_readonly("channels", &CompareResult::channels)
+        .def_readonly("pixels_compared", &CompareResult::pixels_compared)
+        .def_readonly("pixels_different", &CompareResult::pixels_different)
+        .def_readonly("max_abs_error", &CompareResult::max_abs_error)
+        .def_readonly("rmse", &CompareResult::rmse)
+        .def_readonly("psnr", &CompareResult::psnr)
+        .def_readonly("channel_max_abs_error",
+                      &CompareResult::channel_max_abs_error)
+        .def_readonly("channel_rmse", &CompareResult::channel_rmse)
+        .def_readonly("diff_mask", &CompareResult::diff_mask);
+
+    py::class_<FrameComparison>(m, "FrameComparison")
+        .def_readonly("reference_path", &FrameComparison::reference_path)
+        .def_readonly("test_path", &FrameComparison::test_path)
+        .def_readonly("result", &FrameComparison::result);
+
+    // Comparisons run on their own threads; let Python carry on meanwhile
+    m.def("compare_images", &compare_images,
+          "Compare two image files at full resolution",
+          py::arg("reference_path"), py::arg("test_path"),
+          py::arg("options") = CompareOptions(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("compare_pixels", &compare_pixels,
+          "Compare two interleaved pixel arrays of the same size",
+          py::arg("reference"), py::arg("test"), py::arg("width"),
+          py::arg("height"), py::arg("channels"),
+          py::arg("options") = CompareOptions(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("compare_sequences", &compare_sequences,
+          "Compare two numbered sequences frame by frame",
+          py::arg("reference_first_frame"), py::arg("test_first_frame"),
+          py::arg("options") = CompareOptions(),
+          py::call_guard<py::gil_scoped_release>());
+
+    m.def("find_sequence_frames", &find_sequence_frames,
+          "Numbered frames sharing the prefix and extension of first_frame, "
+          "sorted by frame number",
+          py::arg("first_frame"));
+
+    py::class_<PlaybackFrame>(m, "PlaybackFrame")
+        .def_readonly("index", &PlaybackFrame::index)
+        .def_readonly("image", &PlaybackFrame::image);
+
+    py::class_<PlaybackStats>(m, "PlaybackStats")
+        .def_readonly("frames_decoded", &PlaybackStats::frames_decoded)
+        .def_readonly("frames_shown", &PlaybackStats::frames_shown)
+        .def_readonly("frames_dropped", &PlaybackStats::frames_dropped)
+        .def_readonly("frames_buffered", &PlaybackStats::frames_buffered)
+        .def_readonly("average_decode_ms", &PlaybackStats::average_decode_ms)
+        .def_readonly("average_process_ms",
+                      &PlaybackStats::average_process_ms);
+
+    py::class_<SequencePlayer>(m, "SequencePlayer")
+        .def(py::init([](std::vector<std::string> frame_paths, int new_width,
+                         float fps, size_t ring_size, unsigned int workers) {
+                 return std::make_unique<SequencePlayer>(
+                     std::move(frame_paths), new_width, fps, ring_size,
+                     workers);
+             }),
+             py::arg("frame_paths"), py::arg("new_width"),
+             py::arg("fps") = 24.0f, py::arg("ring_size") = 8,
+             py::arg("workers") = 0)
+        .def("play", &SequencePlayer::play, py::arg("direction") = 1)
+        .def("pause", &SequencePlayer::pause)
+        .def("seek", &SequencePlayer::seek, py::arg("frame"))
+        .def("is_playing", &SequencePlayer::is_playing)
+        .def("frame_count", &SequencePlayer::frame_count)
+        .def("current_frame", &SequencePlayer::current_frame,
+             "The frame due now, the last shown one if it isn't decoded yet, "
+             "or None before the first frame is ready")
+        .def("stats", &SequencePlayer::stats);
 
     // m.def("process_image", &process_image,
     //       "A function to apply gamma to image pixels", py::arg("pixels"),
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "planar_image.h"
+#include "scopes.h"
+
+// Multithreaded CPU implementations of the processing kernels. They are used
+// when no OpenCL device is available and mirror the OpenCL results.
+
+unsigned int cpu_thread_count();
+
+// Run fn(begin, end, thread_index) over [0, count) split into one contiguous
+// range per thread
+void parallel_ranges(size_t count,
+                     const std::function<void(size_t, size_t, unsigned int)>& fn);
+
+void cpu_apply_exposure_gamma(float* pixels, size_t count, float exposure,
+                              float inv_gamma);
+
+// Tone-map and bin in one pass; every thread fills its own counters, which
+// are summed at the end
+ScopeData cpu_apply_exposure_gamma_scopes(float* pixels, int width,
+                                          int height, int channels,
+                                          float exposure, float inv_gamma);
+
+// Planar variant: whole padded rows, one straight loop per row
+void cpu_apply_exposure_gamma(PlanarView image, float exposure,
+                              float inv_gamma);
+
+// Tone-map a planar image straight into an interleaved buffer of
+// width * height * channels floats, so the layout change costs no extra pass
+void cpu_apply_exposure_gamma_interleave(const PlanarImage& image,
+                                         float exposure, float inv_gamma,
+                                         float* interleaved);
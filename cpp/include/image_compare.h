@@ -0,0 +1,70 @@
+#pragma once
+#include <limits>
+#include <string>
+#include <vector>
+
+// Render regression checks: two images are streamed in strips of scanlines
+// on every CPU thread and compared value by value. Runs on the CPU only.
+
+struct CompareOptions {
+    // A pixel counts as different (and is set in the mask) when any channel
+    // differs by more than this
+    float pixel_threshold = 1e-3f;
+    // Fail once the absolute error of any value exceeds this
+    float max_abs_limit = std::numeric_limits<float>::infinity();
+    // Fail once more than this fraction of the pixels is different
+    double fail_fraction = 0.0;
+    // Stop reading as soon as one of the limits above is exceeded; the
+    // statistics then only cover the strips compared so far
+    bool early_exit = true;
+    bool build_mask = true;
+    // Peak signal for PSNR; 1.0 is display white
+    float peak = 1.0f;
+    int strip_rows = 64;
+};
+
+struct CompareResult {
+    bool passed = false;
+    bool stopped_early = false;
+    // Set when the images could not be compared at all (missing file,
+    // mismatched size or channels)
+    std::string error;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    size_t pixels_compared = 0;
+    size_t pixels_different = 0;
+    float max_abs_error = 0.0f;
+    double rmse = 0.0;
+    // Infinite for identical images
+    double psnr = 0.0;
+    std::vector<float> channel_max_abs_error;
+    std::vector<double> channel_rmse;
+    // width * height, 1 where the pixel is different; rows that were never
+    // compared are left at 0
+    std::vector<unsigned char> diff_mask;
+};
+
+struct FrameComparison {
+    std::string reference_path;
+    std::string test_path;
+    CompareResult result;
+};
+
+// Full-resolution comparison of two image files (subimage 0)
+CompareResult compare_images(const std::string& reference_path,
+                             const std::string& test_path,
+                             const CompareOptions& options = {});
+
+// Same comparison for interleaved pixels already in memory
+CompareResult compare_pixels(const std::vector<float>& reference,
+                             const std::vector<float>& test, int width,
+                             int height, int channels,
+                             const CompareOptions& options = {});
+
+// Compares the sequences starting at the two first frames (see
+// find_sequence_frames) frame by frame, in frame-number order. A frame that
+// only exists on one side is reported as an error.
+std::vector<FrameComparison> compare_sequences(
+    const std::string& reference_first_frame,
+    const std::string& test_first_frame, const CompareOptions& options = {});
@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 
+#include "planar_image.h"
+
 struct DynamicRangeData {
     float dynamic_range;
     float stops;
@@ -20,13 +22,60 @@ struct ImageData {
     bool original_has_alpha;
     bool output_has_alpha;
     std::unique_ptr<DynamicRangeData> dynamic_range_data;
+    // HDR images are divided by this (their 1% brightest value) on load
+    float normalization_scale = 1.0f;
+    // Filled instead of `pixels` when the image is loaded with planar = true
+    PlanarImage planar;
+    bool is_planar() const { return !planar.empty(); }
     // Utility function to check if dynamic range data exists
     bool hasDynamicRangeData() const { return dynamic_range_data != nullptr; }
 };
 
 DynamicRangeData find_dynamic_range(const std::vector<float>& pixels);
+DynamicRangeData find_dynamic_range(const PlanarImage& image);
+
+// A run of channels sharing a layer prefix ("diffuse.R", "diffuse.G", ...)
+// within one part of a multi-part file. Unprefixed channels (the beauty
+// pass) form the layer with an empty name.
+struct ImageLayer {
+    int subimage;
+    std::string part_name;  // empty when the part has no name
+    std::string name;
+    int first_channel;
+    int channel_count;
+    std::vector<std::string> channel_names;
+};
+
+// Keeps a file open so that its layers can be listed and loaded one after
+// another without reopening it. Only the channels of the requested layer
+// are decoded.
+class ImageReader {
+   public:
+    explicit ImageReader(const std::string& source_path);
+    ~ImageReader();
+    ImageReader(const ImageReader&) = delete;
+    ImageReader& operator=(const ImageReader&) = delete;
+
+    bool is_open() const;
+    // Every part of the file, in order, split into layers
+    const std::vector<ImageLayer>& layers() const;
+    // Loads layers()[layer] the way scanline_image does; empty on failure
+    ImageData load(size_t layer, int new_width, bool planar = false);
+
+   private:
+    struct OpenFile;
+    std::string source_path;
+    std::unique_ptr<OpenFile> file;
+    std::vector<ImageLayer> layer_list;
+};
+
+std::vector<ImageLayer> list_layers(const std::string& source_path);
 
-ImageData scanline_image(const std::string& source_path, int new_width);
+// Loads the first layer of the first part. planar = true keeps one aligned
+// plane per output channel (see planar_image.h) instead of interleaved
+// pixels.
+ImageData scanline_image(const std::string& source_path, int new_width,
+                         bool planar = false);
 
 // std::vector<float> process_image(std::vector<float>& pixels, float gamma);
 
@@ -1,21 +1,55 @@
 #pragma once
-#ifdef USE_OPENCL_120
-#define CL_HPP_MINIMUM_OPENCL_VERSION 120
-#define CL_HPP_TARGET_OPENCL_VERSION 120
-#else
-#define CL_HPP_TARGET_OPENCL_VERSION 300
-#endif
-#define CL_HPP_ENABLE_EXCEPTIONS 1
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
 
-#include <CL/opencl.hpp>
-// #if __has_include(<CL/opencl.hpp>)
-// #include <CL/opencl.hpp>
-// #else
-// #include <opencl.h>
-// #endif
+#include "cl_config.h"
+#include "kernel_tuner.h"
+#include "planar_image.h"
+#include "scopes.h"
 
-#include <map>
-#include <string>
+// One command queue per OpenCL device (or CPU sub-device). Programs are built
+// per context, so every lane keeps a handle to the program of its own context.
+struct DeviceLane {
+    cl::Context context;
+    cl::Device device;
+    cl::CommandQueue queue;
+    // Every kernel lives in this one program
+    cl::Program program;
+    std::string name;
+    bool is_sub_device = false;
+    // Relative weight (compute units x clock), scaled into measured units for
+    // lanes without a measurement; throughput is in floats per microsecond,
+    // smoothed over every band the lane processes.
+    double seed_throughput = 0.0;
+    double throughput = 0.0;
+    bool measured = false;
+    // Device buffers are kept between calls and only grown when needed
+    cl::Buffer pixels_buffer;
+    size_t pixels_capacity = 0;
+    cl::Buffer params_buffer;
+    size_t params_capacity = 0;
+    cl::Buffer scopes_buffer;
+    size_t scopes_capacity = 0;
+    // Ping-pong bilateral grids for local tone mapping, in grid cells
+    cl::Buffer grid_buffer_a;
+    cl::Buffer grid_buffer_b;
+    size_t grid_capacity = 0;
+    // Planar input of apply_exposure_gamma_interleave, in floats
+    cl::Buffer planes_buffer;
+    size_t planes_capacity = 0;
+    // Autotuned apply_exposure_gamma variant; empty if tuning failed
+    std::optional<KernelVariant> exposure_gamma_variant;
+};
+
+// A contiguous range of the pixel array assigned to one lane
+struct WorkBand {
+    size_t lane;
+    size_t offset;
+    size_t count;
+};
 
 class ImageProcessor {
    public:
@@ -31,9 +65,56 @@ class ImageProcessor {
                                                  float exposure) const;
     std::vector<float> apply_exposure_gamma_correction(
         std::vector<float>& pixels, float exposure, float inv_gamma) const;
+    // Planar version, in place. The zero padding stays zero, so the planes
+    // are processed as one flat array of whole rows.
+    void apply_exposure_gamma_correction(PlanarImage& image, float exposure,
+                                         float inv_gamma) const;
+    // Exposure/gamma plus histograms, waveform and vectorscope of the result,
+    // computed in the same pass. Only the scope counters are read back on
+    // top of the pixels.
+    ScopeData apply_exposure_gamma_scopes(std::vector<float>& pixels,
+                                          int width, int height, int channels,
+                                          float exposure,
+                                          float inv_gamma) const;
+    // Bilateral-grid local tone mapping of linear pixels, meant to run before
+    // exposure/gamma. See local_tone_mapping.h for the parameters.
+    std::vector<float> apply_local_tone_mapping(std::vector<float>& pixels,
+                                                int width, int height,
+                                                int channels, float compression,
+                                                float detail) const;
+    // Exposure/gamma of a planar image, returned interleaved for display;
+    // the layout conversion is fused into the same pass
+    std::vector<float> apply_exposure_gamma_interleave(const PlanarImage& image,
+                                                       float exposure,
+                                                       float inv_gamma) const;
+    // Human-readable list of lanes with their throughput estimates and the
+    // kernel variant each one dispatches
+    std::string device_report() const;
 
    private:
-    cl::Context context;
+    using BandDispatch = std::function<void(
+        DeviceLane& lane, const WorkBand& band, cl::Event& write_event,
+        cl::Event& read_event)>;
+
+    void add_platform_lanes(const cl::Platform& platform,
+                            const std::string& kernelCode, KernelTuner& tuner);
+    std::vector<WorkBand> plan_bands(size_t count) const;
+    void dispatch_band(DeviceLane& lane, const WorkBand& band, float* pixels,
+                       const std::string& kernel_name,
+                       const std::vector<float>& parameters,
+                       cl::Event& write_event, cl::Event& read_event) const;
+    void dispatch_scopes_band(DeviceLane& lane, const WorkBand& band,
+                              float* pixels, int width, int channels,
+                              float scale, float inv_gamma, unsigned int* bins,
+                              cl::Event& write_event,
+                              cl::Event& read_event) const;
+    // Plans the bands, runs `dispatch` for each one, waits for all of them
+    // and updates the lane throughputs
+    void run_bands(size_t count, const BandDispatch& dispatch) const;
+
     // cl::Program program;
-    std::map<std::string, cl::Program> programs;
+    // Lanes are mutated by apply_kernel (cached buffers, throughput), which
+    // is logically const; the mutex serializes dispatches.
+    mutable std::vector<DeviceLane> lanes;
+    mutable std::mutex dispatch_mutex;
 };
\ No newline at end of file
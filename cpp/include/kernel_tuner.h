@@ -0,0 +1,56 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cl_config.h"
+
+// One generated variant of the exposure/gamma kernel: every work-item handles
+// items_per_work_item vectors of vector_width floats. A local_size of 0 leaves
+// the work-group size to the driver.
+struct KernelVariant {
+    int vector_width = 1;
+    int items_per_work_item = 1;
+    size_t local_size = 0;
+    double micros = 0.0;  // best benchmark time on the synthetic image
+
+    std::string entry_point() const;
+    std::string describe() const;
+};
+
+// OpenCL source with an entry point for every (vector width, items per
+// work-item) combination. Arguments: pixels, float count, 2^exposure,
+// inv_gamma.
+std::string exposure_gamma_variants_source();
+
+// Enqueue a variant over the first `count` floats of `pixels`
+cl_int enqueue_exposure_gamma(const cl::CommandQueue& queue,
+                              const cl::Program& program,
+                              const KernelVariant& variant,
+                              const cl::Buffer& pixels, size_t count,
+                              float scale, float inv_gamma,
+                              cl::Event* event = nullptr);
+
+// Benchmarks every variant once per device on a synthetic image and
+// remembers the winner in a small text cache, keyed by device, vendor and
+// driver version.
+class KernelTuner {
+   public:
+    KernelTuner();
+    explicit KernelTuner(const std::string& cache_path);
+
+    KernelVariant select(const cl::Context& context, const cl::Device& device,
+                         const cl::CommandQueue& queue,
+                         const cl::Program& program);
+
+   private:
+    KernelVariant benchmark(const cl::Context& context,
+                            const cl::Device& device,
+                            const cl::CommandQueue& queue,
+                            const cl::Program& program) const;
+    void load();
+    void save() const;
+
+    std::string cache_path;
+    std::map<std::string, KernelVariant> winners;
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+
+// Local tone mapping on a bilateral grid (Chen et al.): log2 luminance is
+// splatted into a coarse (x, y, log luminance) grid, blurred there, and
+// sliced back per pixel as the "base" layer. The base is compressed around
+// the normalized white point (log2 = 0) while the detail (log luminance minus
+// base) is kept or boosted.
+
+// Range axis of the grid, in stops. Normalized images put their 99th
+// percentile at 1.0, so this covers deep shadows to well above white.
+constexpr float LTM_LOG_MIN = -16.0f;
+constexpr float LTM_LOG_MAX = 8.0f;
+constexpr float LTM_RANGE_SIGMA = 1.0f;
+// One spare slice so trilinear slicing never reads past the grid
+constexpr int LTM_GRID_DEPTH =
+    static_cast<int>((LTM_LOG_MAX - LTM_LOG_MIN) / LTM_RANGE_SIGMA) + 2;
+
+// Spatial grid geometry derived from the image size. The cell size scales
+// with the width, so the preview and the full-resolution image look alike.
+struct LocalToneGrid {
+    int cell_size;
+    int width;   // grid cells along x
+    int height;  // grid cells along y
+    int depth;   // grid cells along log luminance
+
+    size_t cells() const {
+        return static_cast<size_t>(width) * height * depth;
+    }
+};
+
+LocalToneGrid local_tone_grid(int image_width, int image_height);
+
+// CPU implementation; `compression` scales the base layer (1 = unchanged,
+// 0.5 halves its range in stops), `detail` scales the detail layer.
+void cpu_apply_local_tone_mapping(float* pixels, int width, int height,
+                                  int channels, float compression,
+                                  float detail);
+
+// OpenCL kernels ltm_splat, ltm_blur and ltm_slice
+std::string local_tone_mapping_kernel_source();
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+// Planes start on a 64-byte boundary (a cache line, and a full AVX-512
+// register) and rows are padded to a multiple of 16 floats, so every row of
+// every plane can be processed as whole vectors without a scalar tail.
+constexpr size_t PLANE_ALIGNMENT = 64;
+constexpr size_t PLANE_ALIGNMENT_FLOATS = PLANE_ALIGNMENT / sizeof(float);
+
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(
+            n * sizeof(T), std::align_val_t(PLANE_ALIGNMENT)));
+    }
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(PLANE_ALIGNMENT));
+    }
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const {
+        return false;
+    }
+};
+
+using AlignedFloats = std::vector<float, AlignedAllocator<float>>;
+
+// Non-owning view of planar pixels; what the planar loops operate on
+struct PlanarView {
+    float* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    size_t stride = 0;        // floats per row, including padding
+    size_t plane_stride = 0;  // floats per plane
+
+    float* plane(int channel) const { return data + channel * plane_stride; }
+    float* row(int channel, int y) const {
+        return plane(channel) + static_cast<size_t>(y) * stride;
+    }
+};
+
+// Owning planar (structure-of-arrays) image. Padding is zero-filled, and
+// zero stays zero through normalization and exposure/gamma, so padded rows
+// can be processed whole.
+struct PlanarImage {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    size_t stride = 0;
+    size_t plane_stride = 0;
+    AlignedFloats data;
+
+    PlanarImage() = default;
+    PlanarImage(int width, int height, int channels);
+
+    bool empty() const { return data.empty(); }
+    PlanarView view() {
+        return {data.data(), width, height, channels, stride, plane_stride};
+    }
+    float* row(int channel, int y) { return view().row(channel, y); }
+    const float* row(int channel, int y) const {
+        return data.data() + channel * plane_stride +
+               static_cast<size_t>(y) * stride;
+    }
+};
+
+// Throws std::runtime_error unless pixels holds width * height * channels
+PlanarImage to_planar(const std::vector<float>& pixels, int width, int height,
+                      int channels);
+std::vector<float> to_interleaved(const PlanarImage& image);
+
+// OpenCL source of apply_exposure_gamma_interleave, the device-side version
+// of cpu_apply_exposure_gamma_interleave
+std::string planar_kernel_source();
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Scope resolutions. All scopes are computed from the tone-mapped values
+// clamped to [0, 1]; luma uses Rec.709 weights.
+constexpr int HISTOGRAM_BINS = 256;
+constexpr int WAVEFORM_COLUMNS = 256;
+constexpr int WAVEFORM_LEVELS = 128;
+constexpr int VECTORSCOPE_SIZE = 128;
+
+// Devices and CPU threads accumulate into one flat array of counters:
+// [luma histogram | R, G, B histograms | waveform | vectorscope]
+constexpr int SCOPE_RGB_OFFSET = HISTOGRAM_BINS;
+constexpr int SCOPE_WAVEFORM_OFFSET = SCOPE_RGB_OFFSET + 3 * HISTOGRAM_BINS;
+constexpr int SCOPE_VECTORSCOPE_OFFSET =
+    SCOPE_WAVEFORM_OFFSET + WAVEFORM_COLUMNS * WAVEFORM_LEVELS;
+constexpr int SCOPE_BUFFER_SIZE =
+    SCOPE_VECTORSCOPE_OFFSET + VECTORSCOPE_SIZE * VECTORSCOPE_SIZE;
+
+struct ScopeData {
+    std::vector<unsigned int> luma_histogram;  // HISTOGRAM_BINS
+    // 3 x HISTOGRAM_BINS: all R bins, then G, then B
+    std::vector<unsigned int> rgb_histogram;
+    // WAVEFORM_LEVELS rows of WAVEFORM_COLUMNS; row 0 is black
+    std::vector<unsigned int> waveform;
+    // VECTORSCOPE_SIZE rows (Cr) of VECTORSCOPE_SIZE columns (Cb), centred
+    // on neutral grey
+    std::vector<unsigned int> vectorscope;
+};
+
+// Split the flat counter array into its scopes
+ScopeData unpack_scopes(const std::vector<unsigned int>& bins);
+
+// Bin `pixel_count` already tone-mapped pixels. `first_pixel` is the index of
+// the first one in the whole image, which places it in the waveform.
+void accumulate_scopes(const float* pixels, size_t first_pixel,
+                       size_t pixel_count, int width, int channels,
+                       unsigned int* bins);
+
+// OpenCL source of apply_exposure_gamma_scopes, which tone-maps pixels and
+// fills the flat counter array in the same pass
+std::string scopes_kernel_source();
@@ -0,0 +1,120 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_io.h"
+
+// Frames of a numbered sequence (shot.0001.exr, shot.0002.exr, ...) that
+// share the prefix and extension of `first_frame`, sorted by frame number
+std::vector<std::string> find_sequence_frames(const std::string& first_frame);
+
+// Frame number of a sequence frame (the last run of digits in its file
+// name), or -1 if it has none or it doesn't fit a long long
+long long sequence_frame_number(const std::string& path);
+
+struct PlaybackFrame {
+    int index;
+    std::shared_ptr<ImageData> image;
+};
+
+struct PlaybackStats {
+    size_t frames_decoded = 0;
+    size_t frames_shown = 0;
+    // Frames whose display slot passed without them being shown
+    size_t frames_dropped = 0;
+    // Ready frames currently held in the ring buffer
+    size_t frames_buffered = 0;
+    double average_decode_ms = 0.0;
+    double average_process_ms = 0.0;
+};
+
+// Plays a sequence at a target frame rate. A worker pool decodes the frames
+// ahead of the playhead (in the playback direction) into a fixed ring of
+// preprocessed frames; the playhead itself follows the wall clock, so frames
+// that can't be ready in time are skipped instead of slowing playback down.
+class SequencePlayer {
+   public:
+    // Optional per-frame step run on the worker after decoding
+    using FrameProcessor = std::function<void(ImageData&)>;
+
+    SequencePlayer(std::vector<std::string> frame_paths, int new_width,
+                   float fps, size_t ring_size = 8, unsigned int workers = 0,
+                   FrameProcessor process = nullptr);
+    ~SequencePlayer();
+    SequencePlayer(const SequencePlayer&) = delete;
+    SequencePlayer& operator=(const SequencePlayer&) = delete;
+
+    // direction: 1 plays forward, -1 in reverse
+    void play(int direction = 1);
+    void pause();
+    // Scrub to a frame; playback continues from there if it was running
+    void seek(int frame);
+    bool is_playing() const;
+    int frame_count() const;
+
+    // The frame due now. If it isn't decoded yet the last shown frame is
+    // held; empty until the first frame is ready.
+    std::optional<PlaybackFrame> current_frame();
+    PlaybackStats stats() const;
+
+   private:
+    using Clock = std::chrono::steady_clock;
+    enum class SlotState { Empty, Decoding, Ready };
+    struct Slot {
+        int frame = -1;
+        SlotState state = SlotState::Empty;
+        std::shared_ptr<ImageData> image;
+    };
+
+    // The helpers below expect the mutex to be held
+    int wrap(long long frame) const;
+    long long elapsed_steps(Clock::time_point now) const;
+    int playhead(Clock::time_point now) const;
+    // Frames within this many steps ahead of the playhead are kept
+    size_t window_size() const;
+    bool in_window(int frame, int head) const;
+    // Slot holding (or decoding) `frame`, or -1
+    int find_slot(int frame) const;
+    // An empty slot, or one whose frame has left the window; -1 if every
+    // slot is still needed
+    int free_slot(int head) const;
+    bool claim_frame(Clock::time_point now, int& frame, int& slot_index);
+    void worker_loop();
+    // Worker side, with `lock` released: brings an HDR frame from its own
+    // normalization to the sequence's, so brightness doesn't jump from
+    // frame to frame
+    void rescale_to_sequence(ImageData& image,
+                             std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::string> frame_paths;
+    int new_width;
+    std::chrono::duration<double> frame_period;
+    FrameProcessor process;
+
+    mutable std::mutex mutex;
+    std::condition_variable work_ready;
+    std::vector<Slot> ring;
+    bool playing = false;
+    bool stopping = false;
+    int direction = 1;
+    int anchor_frame = 0;
+    Clock::time_point anchor_time;
+    int last_shown = -1;
+    bool scrubbed = false;
+    // Normalization of the first HDR frame decoded, shared by every frame;
+    // 0 until then
+    float sequence_scale = 0.0f;
+    std::shared_ptr<ImageData> last_image;
+    PlaybackStats totals;
+    double total_decode_ms = 0.0;
+    double total_process_ms = 0.0;
+
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,110 @@
+#include "cpu_backend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "timer.h"
+
+unsigned int cpu_thread_count() {
+    unsigned int threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+}
+
+void parallel_ranges(
+    size_t count, const std::function<void(size_t, size_t, unsigned int)>& fn) {
+    unsigned int threads = static_cast<unsigned int>(
+        std::min<size_t>(cpu_thread_count(), std::max<size_t>(count, 1)));
+    if (threads == 1) {
+        fn(0, count, 0);
+        return;
+    }
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    size_t chunk = (count + threads - 1) / threads;
+    // The calling thread takes the first range
+    for (unsigned int t = 1; t < threads; ++t) {
+        size_t begin = std::min(count, t * chunk);
+        size_t end = std::min(count, begin + chunk);
+        workers.emplace_back(fn, begin, end, t);
+    }
+    fn(0, std::min(count, chunk), 0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void cpu_apply_exposure_gamma(float* pixels, size_t count, float exposure,
+                              float inv_gamma) {
+    float scale = std::exp2(exposure);
+    parallel_ranges(count, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; ++i) {
+            pixels[i] = std::pow(pixels[i] * scale, inv_gamma);
+        }
+    });
+}
+
+ScopeData cpu_apply_exposure_gamma_scopes(float* pixels, int width,
+                                          int height, int channels,
+                                          float exposure, float inv_gamma) {
+    Timer timer("cpu_apply_exposure_gamma_scopes");
+    float scale = std::exp2(exposure);
+    size_t pixel_count = static_cast<size_t>(width) * height;
+    std::vector<std::vector<unsigned int>> thread_bins(
+        cpu_thread_count(), std::vector<unsigned int>(SCOPE_BUFFER_SIZE, 0));
+
+    parallel_ranges(pixel_count, [&](size_t begin, size_t end,
+                                     unsigned int thread) {
+        float* first = pixels + begin * channels;
+        float* last = pixels + end * channels;
+        for (float* value = first; value < last; ++value) {
+            *value = std::pow(*value * scale, inv_gamma);
+        }
+        accumulate_scopes(first, begin, end - begin, width, channels,
+                          thread_bins[thread].data());
+    });
+
+    std::vector<unsigned int> bins(SCOPE_BUFFER_SIZE, 0);
+    for (const auto& partial : thread_bins) {
+        for (size_t i = 0; i < bins.size(); ++i) {
+            bins[i] += partial[i];
+        }
+    }
+    return unpack_scopes(bins);
+}
+
+void cpu_apply_exposure_gamma(PlanarView image, float exposure,
+                              float inv_gamma) {
+    float scale = std::exp2(exposure);
+    size_t rows = static_cast<size_t>(image.channels) * image.height;
+    parallel_ranges(rows, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t r = begin; r < end; ++r) {
+            float* row = image.row(static_cast<int>(r / image.height),
+                                   static_cast<int>(r % image.height));
+            for (size_t x = 0; x < image.stride; ++x) {
+                row[x] = std::pow(row[x] * scale, inv_gamma);
+            }
+        }
+    });
+}
+
+void cpu_apply_exposure_gamma_interleave(const PlanarImage& image,
+                                         float exposure, float inv_gamma,
+                                         float* interleaved) {
+    Timer timer("cpu_apply_exposure_gamma_interleave");
+    float scale = std::exp2(exposure);
+    int channels = image.channels;
+    parallel_ranges(image.height, [&](size_t begin, size_t end,
+                                      unsigned int) {
+        for (size_t y = begin; y < end; ++y) {
+            float* out = interleaved + y * image.width * channels;
+            for (int c = 0; c < channels; ++c) {
+                const float* row = image.row(c, static_cast<int>(y));
+                for (int x = 0; x < image.width; ++x) {
+                    out[x * channels + c] = std::pow(row[x] * scale, inv_gamma);
+                }
+            }
+        }
+    });
+}
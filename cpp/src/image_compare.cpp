@@ -0,0 +1,338 @@
+#include "image_compare.h"
+
+#include <OpenImageIO/imageio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cpu_backend.h"
+#include "sequence_player.h"
+#include "timer.h"
+
+namespace {
+
+// Running error totals of one worker thread
+struct ErrorTotals {
+    std::vector<double> squared_error;
+    std::vector<float> max_abs_error;
+    size_t pixels_compared = 0;
+    size_t pixels_different = 0;
+
+    explicit ErrorTotals(int channels)
+        : squared_error(channels, 0.0), max_abs_error(channels, 0.0f) {}
+};
+
+// Provides rows [ybegin, yend) of both images to a worker thread; returns
+// false (with a message) if they can't be read
+using StripSource = std::function<bool(
+    unsigned int thread, int ybegin, int yend, const float*& reference,
+    const float*& test, std::string& error)>;
+
+// Absolute difference in which NaN only matches NaN
+inline float value_error(float reference, float test) {
+    if (reference == test) {
+        return 0.0f;
+    }
+    float error = std::fabs(reference - test);
+    if (std::isnan(error)) {
+        return std::isnan(reference) && std::isnan(test)
+                   ? 0.0f
+                   : std::numeric_limits<float>::infinity();
+    }
+    return error;
+}
+
+void compare_strip(const float* reference, const float* test,
+                   size_t pixel_count, int channels, float pixel_threshold,
+                   unsigned char* mask, ErrorTotals& totals) {
+    for (size_t i = 0; i < pixel_count; ++i) {
+        float pixel_error = 0.0f;
+        for (int c = 0; c < channels; ++c) {
+            float error = value_error(reference[c], test[c]);
+            totals.squared_error[c] += static_cast<double>(error) * error;
+            totals.max_abs_error[c] = std::max(totals.max_abs_error[c], error);
+            pixel_error = std::max(pixel_error, error);
+        }
+        bool different = pixel_error > pixel_threshold;
+        totals.pixels_different += different;
+        if (mask) {
+            mask[i] = different;
+        }
+        reference += channels;
+        test += channels;
+    }
+    totals.pixels_compared += pixel_count;
+}
+
+// Workers claim strips in order until none are left or, with early_exit,
+// until the failure limits are exceeded. The per-thread totals are merged
+// at the end.
+CompareResult run_comparison(int width, int height, int channels,
+                             const CompareOptions& options,
+                             const StripSource& read_strip) {
+    CompareResult result;
+    result.width = width;
+    result.height = height;
+    result.channels = channels;
+    size_t pixel_count = static_cast<size_t>(width) * height;
+    if (options.build_mask) {
+        result.diff_mask.assign(pixel_count, 0);
+    }
+
+    int strip_rows = std::max(1, options.strip_rows);
+    int strip_count = (height + strip_rows - 1) / strip_rows;
+    size_t allowed_different =
+        static_cast<size_t>(options.fail_fraction * pixel_count);
+    std::atomic<int> next_strip{0};
+    std::atomic<size_t> different_total{0};
+    std::atomic<bool> failed{false};
+    std::mutex error_mutex;
+    unsigned int threads = static_cast<unsigned int>(
+        std::min<size_t>(cpu_thread_count(), std::max(strip_count, 1)));
+    std::vector<ErrorTotals> thread_totals(threads, ErrorTotals(channels));
+
+    parallel_ranges(threads, [&](size_t, size_t, unsigned int thread) {
+        ErrorTotals& totals = thread_totals[thread];
+        while (!(options.early_exit && failed.load())) {
+            int strip = next_strip.fetch_add(1);
+            if (strip >= strip_count) {
+                break;
+            }
+            int ybegin = strip * strip_rows;
+            int yend = std::min(height, ybegin + strip_rows);
+            const float* reference = nullptr;
+            const float* test = nullptr;
+            std::string error;
+            if (!read_strip(thread, ybegin, yend, reference, test, error)) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (result.error.empty()) {
+                    result.error = error;
+                }
+                failed = true;
+                break;
+            }
+
+            size_t different_before = totals.pixels_different;
+            unsigned char* mask =
+                options.build_mask
+                    ? result.diff_mask.data() +
+                          static_cast<size_t>(ybegin) * width
+                    : nullptr;
+            compare_strip(reference, test,
+                          static_cast<size_t>(yend - ybegin) * width,
+                          channels, options.pixel_threshold, mask, totals);
+            size_t strip_different = totals.pixels_different -
+                                     different_before;
+            size_t different = different_total.fetch_add(strip_different) +
+                               strip_different;
+            float max_error = *std::max_element(totals.max_abs_error.begin(),
+                                                totals.max_abs_error.end());
+            if (different > allowed_different ||
+                max_error > options.max_abs_limit) {
+                failed = true;
+            }
+        }
+    });
+
+    // Merge
+    result.channel_max_abs_error.assign(channels, 0.0f);
+    result.channel_rmse.assign(channels, 0.0);
+    std::vector<double> squared_error(channels, 0.0);
+    for (const auto& totals : thread_totals) {
+        result.pixels_compared += totals.pixels_compared;
+        result.pixels_different += totals.pixels_different;
+        for (int c = 0; c < channels; ++c) {
+            squared_error[c] += totals.squared_error[c];
+            result.channel_max_abs_error[c] = std::max(
+                result.channel_max_abs_error[c], totals.max_abs_error[c]);
+        }
+    }
+    double total_squared_error = 0.0;
+    for (int c = 0; c < channels; ++c) {
+        total_squared_error += squared_error[c];
+        result.max_abs_error =
+            std::max(result.max_abs_error, result.channel_max_abs_error[c]);
+        if (result.pixels_compared > 0) {
+            result.channel_rmse[c] =
+                std::sqrt(squared_error[c] / result.pixels_compared);
+        }
+    }
+    double mse = result.pixels_compared > 0
+                     ? total_squared_error /
+                           (static_cast<double>(result.pixels_compared) *
+                            channels)
+                     : 0.0;
+    result.rmse = std::sqrt(mse);
+    result.psnr = mse > 0.0 ? 10.0 * std::log10(static_cast<double>(
+                                                    options.peak) *
+                                                options.peak / mse)
+                            : std::numeric_limits<double>::infinity();
+    result.stopped_early = result.pixels_compared < pixel_count;
+    result.passed = result.error.empty() && !result.stopped_early &&
+                    result.pixels_different <= allowed_different &&
+                    result.max_abs_error <= options.max_abs_limit;
+    return result;
+}
+
+}  // namespace
+
+CompareResult compare_images(const std::string& reference_path,
+                             const std::string& test_path,
+                             const CompareOptions& options) {
+    Timer timer("compare_images");
+    CompareResult result;
+
+    // [01] Open both files and check that they line up
+    auto reference = OIIO::ImageInput::open(reference_path);
+    if (!reference) {
+        result.error = "Cannot open " + reference_path + ": " +
+                       OIIO::geterror();
+        return result;
+    }
+    auto test = OIIO::ImageInput::open(test_path);
+    if (!test) {
+        result.error = "Cannot open " + test_path + ": " + OIIO::geterror();
+        return result;
+    }
+    const OIIO::ImageSpec& reference_spec = reference->spec();
+    const OIIO::ImageSpec& test_spec = test->spec();
+    int width = reference_spec.width;
+    int height = reference_spec.height;
+    int channels = reference_spec.nchannels;
+    if (test_spec.width != width || test_spec.height != height ||
+        test_spec.nchannels != channels) {
+        result.width = width;
+        result.height = height;
+        result.channels = channels;
+        result.error = "Image size mismatch: " + std::to_string(width) + "x" +
+                       std::to_string(height) + "x" + std::to_string(channels) +
+                       " vs " + std::to_string(test_spec.width) + "x" +
+                       std::to_string(test_spec.height) + "x" +
+                       std::to_string(test_spec.nchannels);
+        return result;
+    }
+    // Rows are addressed relative to each file's data window
+    int reference_y = reference_spec.y;
+    int test_y = test_spec.y;
+
+    // Strips of tiled files cover whole rows of tiles
+    CompareOptions strip_options = options;
+    int tile_height = std::max(reference_spec.tile_height,
+                               test_spec.tile_height);
+    if (tile_height > 0) {
+        strip_options.strip_rows =
+            (std::max(1, options.strip_rows) + tile_height - 1) /
+            tile_height * tile_height;
+    }
+
+    // [02] Every worker reads through its own pair of inputs, opened on
+    // first use; the pair opened above goes to the first worker
+    unsigned int threads = cpu_thread_count();
+    std::vector<OIIO::ImageInput::unique_ptr> references(threads);
+    std::vector<OIIO::ImageInput::unique_ptr> tests(threads);
+    std::vector<std::vector<float>> buffers(threads);
+    references[0] = std::move(reference);
+    tests[0] = std::move(test);
+
+    auto read_strip = [&](unsigned int thread, int ybegin, int yend,
+                          const float*& reference_rows,
+                          const float*& test_rows, std::string& error) {
+        if (!references[thread]) {
+            references[thread] = OIIO::ImageInput::open(reference_path);
+            tests[thread] = OIIO::ImageInput::open(test_path);
+            if (!references[thread] || !tests[thread]) {
+                error = "Cannot reopen the images: " + OIIO::geterror();
+                return false;
+            }
+        }
+        size_t strip_floats =
+            static_cast<size_t>(yend - ybegin) * width * channels;
+        std::vector<float>& buffer = buffers[thread];
+        buffer.resize(strip_floats * 2);
+        if (!references[thread]->read_scanlines(
+                0, 0, reference_y + ybegin, reference_y + yend, 0, 0,
+                channels, OIIO::TypeDesc::FLOAT, buffer.data())) {
+            error = reference_path + ": " + references[thread]->geterror();
+            return false;
+        }
+        if (!tests[thread]->read_scanlines(
+                0, 0, test_y + ybegin, test_y + yend, 0, 0, channels,
+                OIIO::TypeDesc::FLOAT, buffer.data() + strip_floats)) {
+            error = test_path + ": " + tests[thread]->geterror();
+            return false;
+        }
+        reference_rows = buffer.data();
+        test_rows = buffer.data() + strip_floats;
+        return true;
+    };
+
+    // [03] Compare
+    return run_comparison(width, height, channels, strip_options, read_strip);
+}
+
+CompareResult compare_pixels(const std::vector<float>& reference,
+                             const std::vector<float>& test, int width,
+                             int height, int channels,
+                             const CompareOptions& options) {
+    Timer timer("compare_pixels");
+    size_t expected = static_cast<size_t>(std::max(width, 0)) *
+                      std::max(height, 0) * std::max(channels, 0);
+    if (expected == 0 || reference.size() != expected ||
+        test.size() != expected) {
+        CompareResult result;
+        result.error = "compare_pixels: pixel counts do not match " +
+                       std::to_string(width) + "x" + std::to_string(height) +
+                       "x" + std::to_string(channels);
+        return result;
+    }
+
+    size_t row_floats = static_cast<size_t>(width) * channels;
+    return run_comparison(
+        width, height, channels, options,
+        [&](unsigned int, int ybegin, int, const float*& reference_rows,
+            const float*& test_rows, std::string&) {
+            reference_rows = reference.data() + ybegin * row_floats;
+            test_rows = test.data() + ybegin * row_floats;
+            return true;
+        });
+}
+
+std::vector<FrameComparison> compare_sequences(
+    const std::string& reference_first_frame,
+    const std::string& test_first_frame, const CompareOptions& options) {
+    Timer timer("compare_sequences");
+
+    // Pair the frames by number, so a missing frame doesn't shift the rest
+    std::map<long long, FrameComparison> frames;
+    for (const auto& path : find_sequence_frames(reference_first_frame)) {
+        frames[sequence_frame_number(path)].reference_path = path;
+    }
+    for (const auto& path : find_sequence_frames(test_first_frame)) {
+        frames[sequence_frame_number(path)].test_path = path;
+    }
+
+    // Frames run one after another; each one already keeps every thread busy
+    // decoding its strips
+    std::vector<FrameComparison> comparisons;
+    comparisons.reserve(frames.size());
+    for (auto& entry : frames) {
+        FrameComparison& frame = entry.second;
+        if (frame.reference_path.empty() || frame.test_path.empty()) {
+            frame.result.error =
+                "Frame " + std::to_string(entry.first) + " is missing from " +
+                (frame.reference_path.empty() ? "the reference" : "the test") +
+                " sequence";
+        } else {
+            frame.result =
+                compare_images(frame.reference_path, frame.test_path, options);
+        }
+        comparisons.push_back(std::move(frame));
+    }
+    return comparisons;
+}
@@ -4,6 +4,7 @@
 #include <OpenImageIO/imagebufalgo.h>
 #include <OpenImageIO/imageio.h>
 OIIO_NAMESPACE_USING
+#include <algorithm>
 #include <cfloat>  // This includes definitions for FLT_MIN and FLT_MAX
 #include <filesystem>
 #include <iostream>
@@ -28,7 +29,8 @@ bool isHDRImage(const std::string& source_path) {
 
 bool reverse_compare(double a, double b) { return a > b; }
 
-void normalize_image(std::vector<float>& pixels) {
+// Divides by the 1% value and returns it
+float normalize_image(std::vector<float>& pixels) {
     Timer timer("normalize_image");
 
     std::vector<float> buffer;
@@ -42,6 +44,38 @@ void normalize_image(std::vector<float>& pixels) {
     for (int i = 0; i < pixels.size(); ++i) {
         pixels[i] = pixels[i] == 0 ? 0 : pixels[i] / scale_factor;
     }
+    return scale_factor;
+}
+
+// Planar version: the 1% value is found with a partial sort of the visible
+// pixels, then every plane is scaled in one run over its padded rows
+float normalize_image(PlanarImage& image) {
+    Timer timer("normalize_image (planar)");
+
+    std::vector<float> buffer;
+    buffer.reserve(static_cast<size_t>(image.width) * image.height *
+                   image.channels);
+    for (int c = 0; c < image.channels; ++c) {
+        for (int y = 0; y < image.height; ++y) {
+            const float* row = image.row(c, y);
+            buffer.insert(buffer.end(), row, row + image.width);
+        }
+    }
+    if (buffer.empty()) {
+        return 1.0f;
+    }
+    size_t index =
+        static_cast<size_t>(floor(0.01 * static_cast<double>(buffer.size())));
+    std::nth_element(buffer.begin(), buffer.begin() + index, buffer.end(),
+                     reverse_compare);
+    float scale_factor = buffer[index];
+
+    float* pixels = image.data.data();
+    size_t count = image.plane_stride * image.channels;
+    for (size_t i = 0; i < count; ++i) {
+        pixels[i] = pixels[i] == 0 ? 0 : pixels[i] / scale_factor;
+    }
+    return scale_factor;
 }
 
 // void apply_gamma(std::vector<float>& pixels, float gamma) {
@@ -83,6 +117,29 @@ DynamicRangeData find_dynamic_range(const std::vector<float>& pixels) {
     return result;
 }
 
+DynamicRangeData find_dynamic_range(const PlanarImage& image) {
+    float max_pixel_value = FLT_MIN;
+    float min_pixel_value = FLT_MAX;
+
+    // Branch-free min/max over each row so the loop vectorizes; padding is
+    // left out
+    for (int c = 0; c < image.channels; ++c) {
+        for (int y = 0; y < image.height; ++y) {
+            const float* row = image.row(c, y);
+            for (int x = 0; x < image.width; ++x) {
+                max_pixel_value = std::max(max_pixel_value, row[x]);
+                min_pixel_value = std::min(min_pixel_value,
+                                           row[x] > 0.0f ? row[x] : FLT_MAX);
+            }
+        }
+    }
+
+    float dynamic_range = max_pixel_value / min_pixel_value;
+    float stops = log2(dynamic_range);
+    DynamicRangeData result = {dynamic_range, stops};
+    return result;
+}
+
 // READ IMAGE FUNCTIONS
 // std::vector<float> read_image(const std::string& source_path, int& width,
 //                               int& height, int& channels) {
@@ -162,25 +219,309 @@ DynamicRangeData find_dynamic_range(const std::vector<float>& pixels) {
 //     return resized_pixels;
 // }
 
-ImageData scanline_image(const std::string& source_path, int new_width) {
+// Nearest-neighbour resampling tables, computed once per load. Column
+// offsets are in floats into the scanline; both are clamped so that
+// upscaling never reads past the last column or line.
+static std::vector<size_t> column_offsets(int width, int new_width,
+                                          int nchannels) {
+    std::vector<size_t> columns(new_width);
+    for (int x = 0; x < new_width; ++x) {
+        int column = static_cast<int>(
+            round(float(x) / float(new_width) * float(width)));
+        columns[x] = static_cast<size_t>(std::min(column, width - 1)) *
+                     nchannels;
+    }
+    return columns;
+}
+
+static int source_line(int y, int height, int new_height) {
+    return std::min(height - 1, static_cast<int>(round(
+                                    float(y) / float(new_height) *
+                                    float(height))));
+}
+
+// Source channel of every output channel. Grey is spread to RGB; from four
+// channels on, colour is the first three channels that aren't alpha and
+// alpha (if any) goes to output channel 3, wherever it is in the file.
+static std::vector<int> output_sources(int nchannels, int alpha_index) {
+    if (nchannels <= 2) {
+        int grey = nchannels == 2 && alpha_index == 0 ? 1 : 0;
+        std::vector<int> sources(3, grey);
+        if (nchannels == 2) {
+            sources.push_back(1 - grey);
+        }
+        return sources;
+    }
+    if (nchannels == 3) {
+        return {0, 1, 2};
+    }
+    std::vector<int> sources;
+    for (int c = 0; c < nchannels && sources.size() < 3; ++c) {
+        if (c != alpha_index) {
+            sources.push_back(c);
+        }
+    }
+    sources.push_back(alpha_index >= 0 ? alpha_index : 3);
+    return sources;
+}
+
+// One output row of the interleaved loader. IN is the input channel count
+// of a file in the usual channel order, or 0 for any other layout, which
+// reads the output_sources table at run time. OUT is the output channel
+// count; grey input is spread to RGB. With TRACK_ALPHA, output channel 3 is
+// folded into min_alpha so a white alpha channel can be dropped afterwards.
+template <int IN, int OUT, bool TRACK_ALPHA>
+static void reshape_row(const float* scanline, const size_t* columns,
+                        int new_width, const int* sources, float* out,
+                        float& min_alpha) {
+    for (int x = 0; x < new_width; ++x) {
+        const float* px = scanline + columns[x];
+        for (int c = 0; c < OUT; ++c) {
+            int source = IN == 0                ? sources[c]
+                         : (IN == 1 || IN == 2) ? (c < 3 ? 0 : 1)
+                                                : c;
+            out[c] = px[source];
+        }
+        if (TRACK_ALPHA) {
+            min_alpha = std::min(min_alpha, out[3]);
+        }
+        out += OUT;
+    }
+}
+
+using ReshapeRow = void (*)(const float*, const size_t*, int, const int*,
+                            float*, float&);
+
+// Picks the specialization for an image; output_nchannels must match
+static ReshapeRow select_reshape_row(int nchannels, bool track_alpha,
+                                     const std::vector<int>& sources) {
+    // The fixed specializations hardcode the usual order: grey then alpha,
+    // or colour then alpha
+    bool usual_order = true;
+    for (int c = 0; c < static_cast<int>(sources.size()); ++c) {
+        int usual = nchannels <= 2 ? (c < 3 ? 0 : 1) : c;
+        usual_order = usual_order && sources[c] == usual;
+    }
+    if (!usual_order) {
+        return track_alpha ? reshape_row<0, 4, true>
+                           : reshape_row<0, 4, false>;
+    }
+    switch (nchannels) {
+        case 1:
+            return reshape_row<1, 3, false>;
+        case 2:
+            return track_alpha ? reshape_row<2, 4, true>
+                               : reshape_row<2, 4, false>;
+        case 3:
+            return reshape_row<3, 3, false>;
+        case 4:
+            return track_alpha ? reshape_row<4, 4, true>
+                               : reshape_row<4, 4, false>;
+        default:
+            return track_alpha ? reshape_row<0, 4, true>
+                               : reshape_row<0, 4, false>;
+    }
+}
+
+// Lines of one channel range of one part. Scanline files are read a line at
+// a time, tiled files a row of tiles at a time so that every tile is decoded
+// once however many of its lines are used.
+class LineReader {
+   public:
+    LineReader(OIIO::ImageInput& input, int subimage,
+               const OIIO::ImageSpec& spec, int chbegin, int chend)
+        : input(input),
+          subimage(subimage),
+          spec(spec),
+          chbegin(chbegin),
+          chend(chend),
+          line_floats(static_cast<size_t>(spec.width) * (chend - chbegin)),
+          band_height(spec.tile_width > 0 ? spec.tile_height : 1),
+          buffer(line_floats * band_height) {}
+
+    // Line y of the data window, or nullptr if it can't be read
+    const float* line(int y) {
+        int band = y / band_height * band_height;
+        if (band != band_begin) {
+            bool read;
+            if (spec.tile_width > 0) {
+                int band_end = std::min(band + band_height, spec.height);
+                read = input.read_tiles(
+                    subimage, 0, spec.x, spec.x + spec.width, spec.y + band,
+                    spec.y + band_end, spec.z, spec.z + std::max(spec.depth, 1),
+                    chbegin, chend, OIIO::TypeDesc::FLOAT, buffer.data());
+            } else {
+                read = input.read_scanlines(
+                    subimage, 0, spec.y + band, spec.y + band + 1, spec.z,
+                    chbegin, chend, OIIO::TypeDesc::FLOAT, buffer.data());
+            }
+            if (!read) {
+                band_begin = -1;
+                return nullptr;
+            }
+            band_begin = band;
+        }
+        return buffer.data() + (y - band_begin) * line_floats;
+    }
+    std::string error() const { return input.geterror(); }
+
+   private:
+    OIIO::ImageInput& input;
+    int subimage;
+    const OIIO::ImageSpec& spec;
+    int chbegin;
+    int chend;
+    size_t line_floats;
+    int band_height;
+    int band_begin = -1;
+    std::vector<float> buffer;
+};
+
+// Planar counterpart of steps [03]-[04] of scanline_image: each output
+// channel is gathered into its own plane through column offsets computed
+// once, and a white alpha plane is dropped by no longer counting it.
+// Empty if a line can't be read.
+static PlanarImage reshape_planar(LineReader& lines, int width, int height,
+                                  int nchannels, int alphaChannelIndex,
+                                  int new_width, int new_height,
+                                  bool& nonWhiteAlphaFound) {
+    // Same channel mapping as the interleaved loader
+    std::vector<int> sources = output_sources(nchannels, alphaChannelIndex);
+    int alpha_plane =
+        alphaChannelIndex >= 0 && sources.size() == 4 ? 3 : -1;
+
+    std::vector<size_t> columns = column_offsets(width, new_width, nchannels);
+
+    PlanarImage image(new_width, new_height,
+                      static_cast<int>(sources.size()));
+    for (int y = 0; y < new_height; ++y) {
+        const float* scanline = lines.line(source_line(y, height, new_height));
+        if (!scanline) {
+            return {};
+        }
+        for (int c = 0; c < image.channels; ++c) {
+            const float* source = scanline + sources[c];
+            float* row = image.row(c, y);
+            for (int x = 0; x < new_width; ++x) {
+                row[x] = source[columns[x]];
+            }
+        }
+    }
+
+    nonWhiteAlphaFound = false;
+    if (alpha_plane >= 0) {
+        float min_alpha = 1.0f;
+        for (int y = 0; y < new_height; ++y) {
+            const float* row = image.row(alpha_plane, y);
+            for (int x = 0; x < new_width; ++x) {
+                min_alpha = std::min(min_alpha, row[x]);
+            }
+        }
+        nonWhiteAlphaFound = min_alpha < 1.0f;
+        if (!nonWhiteAlphaFound) {
+            image.channels -= 1;
+        }
+    }
+    return image;
+}
+
+struct ImageReader::OpenFile {
+    std::unique_ptr<OIIO::ImageInput> input;
+    // Header of every part
+    std::vector<OIIO::ImageSpec> specs;
+};
+
+// "diffuse.R" -> "diffuse"; "R" -> ""
+static std::string layer_prefix(const std::string& channel) {
+    size_t dot = channel.rfind('.');
+    return dot == std::string::npos ? std::string() : channel.substr(0, dot);
+}
+
+ImageReader::ImageReader(const std::string& source_path)
+    : source_path(source_path) {
+    auto input = OIIO::ImageInput::open(source_path);
+    if (!input) {
+        return;
+    }
+    // Channels of a layer are contiguous (the EXR reader groups them), so
+    // every layer is a single channel range. seek_subimage fails past the
+    // last part.
+    file = std::make_unique<OpenFile>();
+    for (int subimage = 0; input->seek_subimage(subimage, 0); ++subimage) {
+        const OIIO::ImageSpec& spec = input->spec();
+        std::string part_name =
+            spec.get_string_attribute("oiio:subimagename");
+        for (int c = 0; c < spec.nchannels; ++c) {
+            std::string channel = c < static_cast<int>(spec.channelnames.size())
+                                      ? spec.channelnames[c]
+                                      : std::string();
+            std::string name = layer_prefix(channel);
+            if (layer_list.empty() || layer_list.back().subimage != subimage ||
+                layer_list.back().name != name) {
+                layer_list.push_back({subimage, part_name, name, c, 0, {}});
+            }
+            layer_list.back().channel_count++;
+            layer_list.back().channel_names.push_back(channel);
+        }
+        file->specs.push_back(spec);
+    }
+    file->input = std::move(input);
+}
+
+ImageReader::~ImageReader() = default;
+
+bool ImageReader::is_open() const { return file != nullptr; }
+
+const std::vector<ImageLayer>& ImageReader::layers() const {
+    return layer_list;
+}
+
+std::vector<ImageLayer> list_layers(const std::string& source_path) {
+    return ImageReader(source_path).layers();
+}
+
+ImageData scanline_image(const std::string& source_path, int new_width,
+                         bool planar) {
+    ImageReader reader(source_path);
+    return reader.load(0, new_width, planar);
+}
+
+ImageData ImageReader::load(size_t layer_index, int new_width, bool planar) {
     Timer timer("scanline_image");
 
-    // [01]. Reading file
-    auto in_file = OIIO::ImageInput::open(source_path);
-    if (!in_file) {
+    // [01]. Selecting the layer; the file is already open
+    if (!file) {
         std::cerr << "Source file is invalid or does not exist!" << std::endl;
         return {};
     }
-    const OIIO::ImageSpec& file_spec = in_file->spec();
+    if (layer_index >= layer_list.size()) {
+        std::cerr << source_path << " has no layer " << layer_index
+                  << std::endl;
+        return {};
+    }
+    const ImageLayer& layer = layer_list[layer_index];
+    const OIIO::ImageSpec& file_spec = file->specs[layer.subimage];
     int width = file_spec.width;
     int height = file_spec.height;
-    int nchannels = file_spec.nchannels;
+    int nchannels = layer.channel_count;
     OIIO::TypeDesc image_format = file_spec.format;
     std::cout << source_path << "\nSize " << width << "x" << height
               << " / Num channels: " << nchannels
               << " / Image format: " << image_format << std::endl;
+    if (!layer.name.empty() || layer.subimage > 0) {
+        std::cout << "Part " << layer.subimage << " " << layer.part_name
+                  << " / Layer: " << layer.name << std::endl;
+    }
 
-    const std::vector<std::string>& channel_names = file_spec.channelnames;
+    // Alpha is looked up without the layer prefix
+    std::vector<std::string> channel_names;
+    for (const auto& channel : layer.channel_names) {
+        channel_names.push_back(layer.name.empty()
+                                    ? channel
+                                    : channel.substr(layer.name.size() + 1));
+    }
+    LineReader lines(*file->input, layer.subimage, file_spec,
+                     layer.first_channel, layer.first_channel + nchannels);
     bool hasAlpha = (std::find(channel_names.begin(), channel_names.end(),
                                "A") != channel_names.end()) ||
                     (std::find(channel_names.begin(), channel_names.end(),
@@ -188,86 +529,86 @@ ImageData scanline_image(const std::string& source_path, int new_width) {
 
     bool nonWhiteAlphaFound = false;  // Flag to identify if we've encountered
                                       // any non-white alpha value.
-    int alphaChannelIndex =
-        hasAlpha ? (nchannels - 1)
-                 : -1;  // Generally, the alpha channel is the last one.
+    // Not necessarily the last channel: a beauty layer is often R,G,B,A,Z
+    int alphaChannelIndex = -1;
+    for (int c = 0; c < nchannels && alphaChannelIndex < 0; ++c) {
+        if (channel_names[c] == "A" || channel_names[c] == "Alpha") {
+            alphaChannelIndex = c;
+        }
+    }
 
     // if nchannels in {3,4} => output_channels = nchannels
     // nchannels could be 2: Y,A (luminance + alpha). => output_channels = 4
-    int output_nchannels = (nchannels == 3 || nchannels == 4) ? nchannels : 4;
+    // nchannels 1: Y is spread to RGB => output_channels = 3
+    int output_nchannels =
+        (nchannels == 3 || nchannels == 4) ? nchannels
+                                           : (nchannels == 1 ? 3 : 4);
+    // Only a fourth output channel can carry alpha
+    bool trackAlpha = hasAlpha && output_nchannels == 4;
 
     // [02] Preparing arrays of pixels and scanline, calculate new height
     int new_height = static_cast<int>(float(height) / float(width) * new_width);
+    if (planar) {
+        ImageData result;
+        result.planar =
+            reshape_planar(lines, width, height, nchannels, alphaChannelIndex,
+                           new_width, new_height, nonWhiteAlphaFound);
+        if (result.planar.empty()) {
+            std::cerr << "Failed to read " << source_path << ": "
+                      << lines.error() << std::endl;
+            return {};
+        }
+        result.original_width = width;
+        result.original_height = height;
+        result.num_original_channels = nchannels;
+        result.resized_width = new_width;
+        result.resized_height = new_height;
+        result.num_output_channels = result.planar.channels;
+        result.original_has_alpha = hasAlpha;
+        result.output_has_alpha = hasAlpha && nonWhiteAlphaFound;
+        if (isHDRImage(source_path)) {
+            result.dynamic_range_data = std::make_unique<DynamicRangeData>(
+                find_dynamic_range(result.planar));
+            result.normalization_scale = normalize_image(result.planar);
+        }
+        std::cout << "New size: " << new_width << "x" << new_height << ";"
+                  << " output planes: " << result.num_output_channels
+                  << std::endl;
+        return result;
+    }
     std::vector<float> pixels(new_width * new_height * output_nchannels);
-    std::vector<float> scanline(width * nchannels);
 
-    // [03] Reshaping pixels
-    int lowres_pixel_index = 0;
-    float alphaValue = 0.0f;
+    // [03] Reshaping pixels: the row loop is specialized once per image,
+    // so the per-pixel work is a table lookup and a fixed-size copy
+    std::vector<size_t> columns = column_offsets(width, new_width, nchannels);
+    std::vector<int> sources = output_sources(nchannels, alphaChannelIndex);
+    ReshapeRow reshape = select_reshape_row(nchannels, trackAlpha, sources);
+    float min_alpha = 1.0f;
     for (int y = 0; y < new_height; ++y) {
-        // read highres scanline
-        int highres_line_index = static_cast<int>(
-            round(float(y) / float(new_height) * float(height)));
-        in_file->read_scanline(highres_line_index, 0, OIIO::TypeDesc::FLOAT,
-                               &scanline[0]);
-        for (int x = 0; x < new_width; ++x) {
-            int highres_line_pixel_index = static_cast<int>(
-                round(float(x) / float(new_width) * float(width)) * nchannels);
-
-            if (nchannels == 2) {  // specific case for 2-channel images
-                // Copy the Y (luminance) and A (alpha) channels.
-                for (int chnl = 0; chnl < 3; ++chnl) {
-                    pixels[lowres_pixel_index + chnl] =
-                        scanline[highres_line_pixel_index];
-                }
-                alphaValue = scanline[highres_line_pixel_index +
-                                      alphaChannelIndex];  // A
-                pixels[lowres_pixel_index + 3] = alphaValue;
-                if (hasAlpha && !nonWhiteAlphaFound) {
-                    if (alphaValue < 1.0f) {
-                        nonWhiteAlphaFound = true;  // If any alpha value is not
-                                                    // white, set the flag true.
-                    }
-                }
-                lowres_pixel_index += 4;  // proceed by 2 channels
-            } else {
-                // Normal scenario: copy all channels.
-                for (int chnl = 0; chnl < output_nchannels; ++chnl) {
-                    pixels[lowres_pixel_index + chnl] =
-                        scanline[highres_line_pixel_index + chnl];
-                    if (hasAlpha && !nonWhiteAlphaFound) {
-                        if (chnl == alphaChannelIndex) {
-                            alphaValue =
-                                scanline[highres_line_pixel_index + chnl];
-                            if (alphaValue < 1.0f) {
-                                nonWhiteAlphaFound =
-                                    true;  // If any alpha value is not white,
-                                           // set the flag true.
-                            }
-                        }
-                    }
-                }
-                lowres_pixel_index += output_nchannels;
-            }
+        // read highres scanline (only this layer's channels)
+        const float* scanline = lines.line(source_line(y, height, new_height));
+        if (!scanline) {
+            std::cerr << "Failed to read " << source_path << ": "
+                      << lines.error() << std::endl;
+            return {};
         }
+        reshape(scanline, columns.data(), new_width, sources.data(),
+                &pixels[static_cast<size_t>(y) * new_width * output_nchannels],
+                min_alpha);
     }
-
-    // [04] Get rid of Alpha if it's not needed
-    bool outputHasAlpha = hasAlpha && nonWhiteAlphaFound;
-    if (hasAlpha && !nonWhiteAlphaFound) {
-        std::vector<float> compact_pixels;
-        // Reserves space for the new pixel array without the alpha channel.
-        // This helps in avoiding multiple reallocations.
-        compact_pixels.reserve((pixels.size() * 3) / 4);
-
-        for (int i = 0; i < pixels.size(); i++) {
-            if ((i + 1) % 4 != 0) {
-                compact_pixels.push_back(pixels[i]);
+    nonWhiteAlphaFound = min_alpha < 1.0f;
+
+    // [04] Get rid of Alpha if it's not needed; compacting in place is safe
+    // because every pixel moves towards the front
+    bool outputHasAlpha = trackAlpha && nonWhiteAlphaFound;
+    if (trackAlpha && !nonWhiteAlphaFound) {
+        size_t pixel_count = static_cast<size_t>(new_width) * new_height;
+        for (size_t i = 0; i < pixel_count; ++i) {
+            for (int chnl = 0; chnl < 3; ++chnl) {
+                pixels[i * 3 + chnl] = pixels[i * 4 + chnl];
             }
         }
-
-        pixels.swap(compact_pixels);
-        compact_pixels.clear();
+        pixels.resize(pixel_count * 3);
         output_nchannels -= 1;
     }
 
@@ -289,7 +630,7 @@ ImageData scanline_image(const std::string& source_path, int new_width) {
         // is held by a unique_ptr
         result.dynamic_range_data = std::make_unique<DynamicRangeData>(
             find_dynamic_range(result.pixels));
-        normalize_image(result.pixels);
+        result.normalization_scale = normalize_image(result.pixels);
     } else {
         result.dynamic_range_data = nullptr;  // No dynamic range data
     }
@@ -1,13 +1,19 @@
 #include "image_processing.h"
 
-#include <CL/opencl.hpp>
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <numeric>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "cpu_backend.h"
+#include "local_tone_mapping.h"
 #include "timer.h"
 
 /* Version A: Open several kernel files from the folder */
@@ -93,23 +99,17 @@
 // }
 
 // Version B: OpenCL kernel file in-line
+// Bands are aligned so that they never cut a pixel of 1-4 channels (or a
+// float8 vector) in half. Images below MIN_SPLIT_COUNT floats stay on the
+// fastest lane, and bands below MIN_BAND_COUNT are not worth a dispatch.
+constexpr size_t BAND_ALIGNMENT = 192;
+constexpr size_t MIN_SPLIT_COUNT = 4 << 20;
+constexpr size_t MIN_BAND_COUNT = 256 << 10;
+constexpr double THROUGHPUT_SMOOTHING = 0.5;
+constexpr size_t SCOPES_LOCAL_SIZE = 256;
+
 ImageProcessor::ImageProcessor() {
     try {
-        context = cl::Context(CL_DEVICE_TYPE_GPU);
-        std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
-        // Print device details
-        for (const auto& device : devices) {
-            std::string deviceName = device.getInfo<CL_DEVICE_NAME>();
-            std::string deviceVendor = device.getInfo<CL_DEVICE_VENDOR>();
-            cl_uint deviceComputeUnits =
-                device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
-
-            std::cout << "Device Name: " << deviceName << "\n";
-            std::cout << "Device Vendor: " << deviceVendor << "\n";
-            std::cout << "Device Max Compute Units: " << deviceComputeUnits
-                      << "\n";
-        }
-
         // Define your OpenCL kernel code as a string.
         // This is a raw string literal encompassing multiple lines.
         std::string kernelCode = R"(
@@ -134,25 +134,54 @@ ImageProcessor::ImageProcessor() {
             }
         )";  // End of raw string literal
 
-        // Build the program from the kernel source code
-        cl::Program::Sources sources;
-        sources.push_back(
-            {kernelCode.c_str(),
-             kernelCode.length() + 1});  // The '+1' is to account for the
-                                         // string's null terminator
-
-        cl::Program program(context, sources);
-        if (program.build(devices) != CL_SUCCESS) {
-            std::cerr << "OpenCL build error: "
-                      << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
-                      << std::endl;
-            throw std::runtime_error(
-                "OpenCL build error: " +
-                program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]));
+        // Generated vectorized variants live in the same program; the tuner
+        // picks one per device.
+        kernelCode += exposure_gamma_variants_source();
+        kernelCode += scopes_kernel_source();
+        kernelCode += local_tone_mapping_kernel_source();
+        kernelCode += planar_kernel_source();
+        KernelTuner tuner;
+
+        // Every platform gets its own context; a broken ICD should not hide
+        // the devices of the other platforms.
+        std::vector<cl::Platform> platforms;
+        try {
+            cl::Platform::get(&platforms);
+        } catch (const cl::Error& e) {
+            std::cerr << "No OpenCL platform found: " << e.what() << " : "
+                      << e.err() << std::endl;
+        }
+        for (const auto& platform : platforms) {
+            try {
+                add_platform_lanes(platform, kernelCode, tuner);
+            } catch (const cl::Error& e) {
+                std::cerr << "Skipping OpenCL platform "
+                          << platform.getInfo<CL_PLATFORM_NAME>() << ": "
+                          << e.what() << " : " << e.err() << std::endl;
+            }
+        }
+        if (lanes.empty()) {
+            std::cout << "No usable OpenCL device found; processing on the "
+                      << "CPU with " << cpu_thread_count() << " threads\n";
         }
 
-        // Store the compiled program for later use
-        programs["apply_exposure_gamma"] = program;
+        // Print device details
+        for (const auto& lane : lanes) {
+            std::string deviceVendor = lane.device.getInfo<CL_DEVICE_VENDOR>();
+            cl_uint deviceComputeUnits =
+                lane.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+            std::cout << "Device Name: " << lane.name
+                      << (lane.is_sub_device ? " (sub-device)" : "") << "\n";
+            std::cout << "Device Vendor: " << deviceVendor << "\n";
+            std::cout << "Device Max Compute Units: " << deviceComputeUnits
+                      << "\n";
+            std::cout << "apply_exposure_gamma: "
+                      << (lane.exposure_gamma_variant
+                              ? lane.exposure_gamma_variant->describe()
+                              : std::string("generic kernel"))
+                      << "\n";
+        }
 
     } catch (const cl::Error& e) {
         std::cerr << "Exception in ImageProcessor: " << e.what() << " : "
@@ -168,91 +197,666 @@ ImageProcessor::ImageProcessor() {
     }
 }
 
+void ImageProcessor::add_platform_lanes(const cl::Platform& platform,
+                                        const std::string& kernelCode,
+                                        KernelTuner& tuner) {
+    // [01] Collect GPUs and CPUs. getDevices throws CL_DEVICE_NOT_FOUND when
+    // the platform has no device of the requested type.
+    std::vector<cl::Device> gpus, cpus;
+    try {
+        platform.getDevices(CL_DEVICE_TYPE_GPU, &gpus);
+    } catch (const cl::Error&) {
+    }
+    try {
+        platform.getDevices(CL_DEVICE_TYPE_CPU, &cpus);
+    } catch (const cl::Error&) {
+    }
+
+    // [02] Split CPU devices along NUMA/cache domains so that each domain
+    // gets its own queue; keep the whole device if it can't be partitioned.
+    std::vector<cl::Device> devices = gpus;
+    std::vector<bool> sub_device_flags(gpus.size(), false);
+    for (auto& cpu : cpus) {
+        std::vector<cl::Device> sub_devices;
+        try {
+            const cl_device_partition_property properties[] = {
+                CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+                CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE, 0};
+            cpu.createSubDevices(properties, &sub_devices);
+        } catch (const cl::Error&) {
+            sub_devices.clear();
+        }
+        if (sub_devices.size() > 1) {
+            devices.insert(devices.end(), sub_devices.begin(),
+                           sub_devices.end());
+            sub_device_flags.insert(sub_device_flags.end(), sub_devices.size(),
+                                    true);
+        } else {
+            devices.push_back(cpu);
+            sub_device_flags.push_back(false);
+        }
+    }
+    if (devices.empty()) {
+        return;
+    }
+
+    // [03] Build the program once for the whole context. Exceptions are
+    // enabled, so a failed build throws cl::BuildError: print every failing
+    // device's log, drop those devices and rebuild for the rest, so that one
+    // broken compiler doesn't cost the platform its other devices.
+    cl::Context context(devices);
+    cl::Program::Sources sources;
+    sources.push_back(
+        {kernelCode.c_str(),
+         kernelCode.length() + 1});  // The '+1' is to account for the
+                                     // string's null terminator
+    cl::Program program;
+    while (true) {
+        program = cl::Program(context, sources);
+        try {
+            program.build(devices);
+            break;
+        } catch (const cl::BuildError& e) {
+            for (const auto& entry : e.getBuildLog()) {
+                std::cerr << "OpenCL build error on "
+                          << entry.first.getInfo<CL_DEVICE_NAME>() << ":\n"
+                          << entry.second << std::endl;
+            }
+            std::vector<cl::Device> built;
+            std::vector<bool> built_flags;
+            for (size_t i = 0; i < devices.size(); ++i) {
+                if (program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(
+                        devices[i]) != CL_BUILD_ERROR) {
+                    built.push_back(devices[i]);
+                    built_flags.push_back(sub_device_flags[i]);
+                }
+            }
+            // Nothing to drop means the failure isn't device specific
+            if (built.size() == devices.size()) {
+                throw;
+            }
+            devices.swap(built);
+            sub_device_flags.swap(built_flags);
+            if (devices.empty()) {
+                return;
+            }
+        }
+    }
+
+    // [04] One profiling-enabled queue per device, with the tuned
+    // exposure/gamma variant. Sub-devices of one CPU share the cached result.
+    for (size_t i = 0; i < devices.size(); ++i) {
+        DeviceLane lane;
+        lane.context = context;
+        lane.device = devices[i];
+        lane.queue =
+            cl::CommandQueue(context, devices[i], CL_QUEUE_PROFILING_ENABLE);
+        lane.program = program;
+        lane.name = devices[i].getInfo<CL_DEVICE_NAME>();
+        lane.is_sub_device = sub_device_flags[i];
+        lane.seed_throughput =
+            static_cast<double>(
+                devices[i].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()) *
+            static_cast<double>(
+                devices[i].getInfo<CL_DEVICE_MAX_CLOCK_FREQUENCY>());
+        try {
+            lane.exposure_gamma_variant =
+                tuner.select(context, devices[i], lane.queue, program);
+        } catch (const cl::Error& e) {
+            std::cerr << "Kernel tuning failed on " << lane.name << ": "
+                      << e.what() << " : " << e.err()
+                      << "; using the generic kernel" << std::endl;
+        }
+        lanes.push_back(std::move(lane));
+    }
+}
+
+std::vector<WorkBand> ImageProcessor::plan_bands(size_t count) const {
+    // Seeds are in different units from measurements. Once any lane has
+    // been measured, the seeds of the others are converted with the
+    // measured lanes' average throughput per seed unit. Lanes that never get
+    // a band (too small a share, or images below MIN_SPLIT_COUNT) would
+    // otherwise keep the planner on seeds forever. A lagging measured lane
+    // then loses weight to the others, which get measured once they win a
+    // band.
+    double measured_per_seed = 0.0;
+    size_t measured_lanes = 0;
+    for (const auto& lane : lanes) {
+        if (lane.measured && lane.seed_throughput > 0.0) {
+            measured_per_seed += lane.throughput / lane.seed_throughput;
+            ++measured_lanes;
+        }
+    }
+    if (measured_lanes > 0) {
+        measured_per_seed /= static_cast<double>(measured_lanes);
+    }
+    auto weight = [&](size_t i) {
+        if (measured_lanes == 0) {
+            return lanes[i].seed_throughput;
+        }
+        return lanes[i].measured ? lanes[i].throughput
+                                 : lanes[i].seed_throughput * measured_per_seed;
+    };
+
+    // Slowest lanes first: the fastest one comes last and takes the
+    // remainder left over by rounding.
+    std::vector<size_t> order(lanes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return weight(a) < weight(b); });
+    size_t fastest = order.back();
+    if (count == 0) {
+        return {{fastest, 0, 0}};
+    }
+    if (lanes.size() == 1 || count < MIN_SPLIT_COUNT) {
+        return {{fastest, 0, count}};
+    }
+
+    double total_weight = 0.0;
+    for (size_t i = 0; i < lanes.size(); ++i) {
+        total_weight += weight(i);
+    }
+
+    std::vector<WorkBand> bands;
+    size_t offset = 0;
+    for (size_t i : order) {
+        if (i == fastest) {
+            bands.push_back({i, offset, count - offset});
+            break;
+        }
+        size_t share = static_cast<size_t>(static_cast<double>(count) *
+                                           weight(i) / total_weight);
+        share -= share % BAND_ALIGNMENT;
+        if (share < MIN_BAND_COUNT) {
+            continue;
+        }
+        bands.push_back({i, offset, share});
+        offset += share;
+    }
+    return bands;
+}
+
+void ImageProcessor::dispatch_band(DeviceLane& lane, const WorkBand& band,
+                                   float* pixels,
+                                   const std::string& kernel_name,
+                                   const std::vector<float>& parameters,
+                                   cl::Event& write_event,
+                                   cl::Event& read_event) const {
+    cl_int err;
+    // Look the kernel up before anything is enqueued, so a missing kernel
+    // leaves no write pending on the host array
+    bool tuned =
+        kernel_name == "apply_exposure_gamma" && lane.exposure_gamma_variant;
+    cl::Kernel kernel;
+    if (tuned) {
+        if (parameters.size() != 2) {
+            throw std::runtime_error(
+                "apply_exposure_gamma expects 2 parameters, got " +
+                std::to_string(parameters.size()));
+        }
+    } else {
+        try {
+            kernel = cl::Kernel(lane.program, kernel_name.c_str());
+        } catch (const cl::Error& e) {
+            std::cerr << "Error: kernel '" << kernel_name
+                      << "' not found in the program: " << e.what() << " : "
+                      << e.err() << "\n";
+            throw std::runtime_error("Kernel '" + kernel_name +
+                                     "' not found");
+        }
+    }
+
+    // Prepare buffers
+    size_t band_bytes = band.count * sizeof(float);
+    if (lane.pixels_capacity < band.count) {
+        lane.pixels_buffer =
+            cl::Buffer(lane.context, CL_MEM_READ_WRITE, band_bytes);
+        lane.pixels_capacity = band.count;
+    }
+    size_t params_count = std::max<size_t>(parameters.size(), 1);
+    if (lane.params_capacity < params_count) {
+        lane.params_buffer = cl::Buffer(lane.context, CL_MEM_READ_ONLY,
+                                        params_count * sizeof(float));
+        lane.params_capacity = params_count;
+    }
+
+    err = lane.queue.enqueueWriteBuffer(lane.pixels_buffer, CL_FALSE, 0,
+                                        band_bytes, pixels + band.offset,
+                                        nullptr, &write_event);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueWriteBuffer: " +
+                                 std::to_string(err));
+    }
+    // Execute kernel; the in-order queue chains write -> kernel -> read
+    if (tuned) {
+        // Tuned variant: 2^exposure is computed once here instead of per item
+        err = enqueue_exposure_gamma(lane.queue, lane.program,
+                                     *lane.exposure_gamma_variant,
+                                     lane.pixels_buffer, band.count,
+                                     std::exp2(parameters[0]), parameters[1]);
+    } else {
+        if (!parameters.empty()) {
+            err = lane.queue.enqueueWriteBuffer(
+                lane.params_buffer, CL_FALSE, 0,
+                parameters.size() * sizeof(float), parameters.data());
+            if (err != CL_SUCCESS) {
+                throw std::runtime_error("Error in enqueueWriteBuffer: " +
+                                         std::to_string(err));
+            }
+        }
+        kernel.setArg(0, lane.pixels_buffer);
+        kernel.setArg(1, static_cast<unsigned int>(band.count));
+        kernel.setArg(2, lane.params_buffer);
+        kernel.setArg(3, static_cast<unsigned int>(parameters.size()));
+        err = lane.queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                              cl::NDRange(band.count),
+                                              cl::NullRange);
+    }
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueNDRangeKernel: " +
+                                 std::to_string(err));
+    }
+    // Read straight back into this band's slice of the host array
+    err = lane.queue.enqueueReadBuffer(lane.pixels_buffer, CL_FALSE, 0,
+                                       band_bytes, pixels + band.offset,
+                                       nullptr, &read_event);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueReadBuffer: " +
+                                 std::to_string(err));
+    }
+    lane.queue.flush();
+}
+
+void ImageProcessor::run_bands(size_t count,
+                               const BandDispatch& dispatch) const {
+    // [01] Split the array into bands weighted by lane throughput
+    std::vector<WorkBand> bands = plan_bands(count);
+
+    // [02] Enqueue every band on its lane without blocking. If any enqueue
+    // fails, drain the lanes already started, and the one that failed part
+    // way, before the host array can go away.
+    std::vector<cl::Event> write_events(bands.size());
+    std::vector<cl::Event> read_events(bands.size());
+    size_t dispatched = 0;
+    try {
+        for (; dispatched < bands.size(); ++dispatched) {
+            const WorkBand& band = bands[dispatched];
+            dispatch(lanes[band.lane], band, write_events[dispatched],
+                     read_events[dispatched]);
+        }
+    } catch (...) {
+        for (size_t i = 0; i <= dispatched && i < bands.size(); ++i) {
+            lanes[bands[i].lane].queue.finish();
+        }
+        throw;
+    }
+
+    // [03] Merge: every band reads back into place, so waiting for the read
+    // events is all that's left. Events from different contexts can't go
+    // into a single clWaitForEvents call.
+    for (auto& event : read_events) {
+        event.wait();
+    }
+
+    // [04] Rebalance: fold each band's queued->done time into its lane's
+    // throughput, so a lagging device gets a smaller band next time.
+    for (size_t i = 0; i < bands.size(); ++i) {
+        cl_ulong queued =
+            write_events[i].getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+        cl_ulong end =
+            read_events[i].getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        double micros =
+            end > queued ? static_cast<double>(end - queued) / 1000.0 : 1.0;
+        double sample = static_cast<double>(bands[i].count) / micros;
+        DeviceLane& lane = lanes[bands[i].lane];
+        lane.throughput = lane.measured
+                              ? THROUGHPUT_SMOOTHING * sample +
+                                    (1.0 - THROUGHPUT_SMOOTHING) *
+                                        lane.throughput
+                              : sample;
+        lane.measured = true;
+    }
+}
+
 std::vector<float> ImageProcessor::apply_kernel(
     std::vector<float>& pixels, const std::string& kernel_name,
     const std::vector<float>& parameters) const {
     Timer timer("apply_kernel: " + kernel_name);
+    std::lock_guard<std::mutex> lock(dispatch_mutex);
+    if (pixels.empty()) {
+        return pixels;
+    }
 
-    // std::vector<float> modified_pixels = pixels;
+    if (lanes.empty()) {
+        if (kernel_name != "apply_exposure_gamma" || parameters.size() != 2) {
+            throw std::runtime_error("Kernel '" + kernel_name +
+                                     "' has no CPU implementation");
+        }
+        cpu_apply_exposure_gamma(pixels.data(), pixels.size(), parameters[0],
+                                 parameters[1]);
+        return pixels;
+    }
+
+    run_bands(pixels.size(), [&](DeviceLane& lane, const WorkBand& band,
+                                 cl::Event& write_event,
+                                 cl::Event& read_event) {
+        dispatch_band(lane, band, pixels.data(), kernel_name, parameters,
+                      write_event, read_event);
+    });
+    // Return the modified pixel data
+    return pixels;
+}
+
+void ImageProcessor::dispatch_scopes_band(
+    DeviceLane& lane, const WorkBand& band, float* pixels, int width,
+    int channels, float scale, float inv_gamma, unsigned int* bins,
+    cl::Event& write_event, cl::Event& read_event) const {
     cl_int err;
     // Prepare buffers
-    size_t num_pixels = pixels.size();
-    cl::Buffer buffer_pixels(context, CL_MEM_READ_WRITE,
-                             num_pixels * sizeof(float));
-    cl::CommandQueue queue(context);
-    err = queue.enqueueWriteBuffer(buffer_pixels, CL_TRUE, 0,
-                                   num_pixels * sizeof(float), pixels.data());
+    size_t band_bytes = band.count * sizeof(float);
+    if (lane.pixels_capacity < band.count) {
+        lane.pixels_buffer =
+            cl::Buffer(lane.context, CL_MEM_READ_WRITE, band_bytes);
+        lane.pixels_capacity = band.count;
+    }
+    size_t scopes_bytes = SCOPE_BUFFER_SIZE * sizeof(unsigned int);
+    if (lane.scopes_capacity < SCOPE_BUFFER_SIZE) {
+        lane.scopes_buffer =
+            cl::Buffer(lane.context, CL_MEM_READ_WRITE, scopes_bytes);
+        lane.scopes_capacity = SCOPE_BUFFER_SIZE;
+    }
+
+    err = lane.queue.enqueueWriteBuffer(lane.pixels_buffer, CL_FALSE, 0,
+                                        band_bytes, pixels + band.offset,
+                                        nullptr, &write_event);
     if (err != CL_SUCCESS) {
-        // std::cerr << "Error in enqueueWriteBuffer: " << err << "\n";
-        // exit(EXIT_FAILURE);
         throw std::runtime_error("Error in enqueueWriteBuffer: " +
                                  std::to_string(err));
     }
+    err = lane.queue.enqueueFillBuffer(lane.scopes_buffer, 0u, 0,
+                                       scopes_bytes);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueFillBuffer: " +
+                                 std::to_string(err));
+    }
 
-    // std::cout << "Applying kernel: " << kernel_name << "\n";
-    // std::cout << "Parameter value: " << parameter_value << "\n";
+    // Bands never split a pixel, so the band maps to whole pixels
+    size_t pixel_count = band.count / channels;
+    cl::Kernel kernel(lane.program, "apply_exposure_gamma_scopes");
+    kernel.setArg(0, lane.pixels_buffer);
+    kernel.setArg(1, static_cast<unsigned int>(pixel_count));
+    kernel.setArg(2, static_cast<unsigned int>(channels));
+    kernel.setArg(3, static_cast<unsigned int>(width));
+    kernel.setArg(4, static_cast<unsigned int>(band.offset / channels));
+    kernel.setArg(5, scale);
+    kernel.setArg(6, inv_gamma);
+    kernel.setArg(7, lane.scopes_buffer);
 
-    // Set kernel arguments
-    cl::Buffer buffer_params(context, CL_MEM_READ_ONLY,
-                             parameters.size() * sizeof(float));
-    err = queue.enqueueWriteBuffer(buffer_params, CL_TRUE, 0,
-                                   parameters.size() * sizeof(float),
-                                   parameters.data());
+    // The local histograms need real work-groups, so the local size is
+    // fixed instead of left to the driver
+    size_t local_size = std::min<size_t>(
+        SCOPES_LOCAL_SIZE,
+        kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(lane.device));
+    size_t global_size =
+        (pixel_count + local_size - 1) / local_size * local_size;
+    err = lane.queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                          cl::NDRange(global_size),
+                                          cl::NDRange(local_size));
     if (err != CL_SUCCESS) {
-        // std::cerr << "Error in enqueueWriteBuffer for parameters: " << err
-        //           << "\n";
-        // exit(EXIT_FAILURE);
-        throw std::runtime_error("Error in enqueueWriteBuffer: " +
+        throw std::runtime_error("Error in enqueueNDRangeKernel: " +
                                  std::to_string(err));
     }
 
-    cl::Program program;
-    try {
-        program = programs.at(kernel_name);
-        // std::cout << "Program: " << program.getInfo<CL_PROGRAM_SOURCE>()
-        //           << "\n";
-    } catch (const std::out_of_range& e) {
-        std::cerr << "Error: Program with key '" << kernel_name
-                  << "' not found!\n";
-        std::cerr << "Exception: " << e.what() << "\n";
-        // Possibly print all existing keys for debugging:
-        std::cerr << "Existing keys: ";
-        for (const auto& pair : programs) {
-            std::cerr << pair.first << " ";
+    // Only the pixels and the small counter array come back
+    err = lane.queue.enqueueReadBuffer(lane.pixels_buffer, CL_FALSE, 0,
+                                       band_bytes, pixels + band.offset);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueReadBuffer: " +
+                                 std::to_string(err));
+    }
+    err = lane.queue.enqueueReadBuffer(lane.scopes_buffer, CL_FALSE, 0,
+                                       scopes_bytes, bins, nullptr,
+                                       &read_event);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueReadBuffer: " +
+                                 std::to_string(err));
+    }
+    lane.queue.flush();
+}
+
+ScopeData ImageProcessor::apply_exposure_gamma_scopes(
+    std::vector<float>& pixels, int width, int height, int channels,
+    float exposure, float inv_gamma) const {
+    Timer timer("apply_exposure_gamma_scopes");
+    if (width <= 0 || height <= 0 || channels <= 0 ||
+        pixels.size() != static_cast<size_t>(width) * height * channels) {
+        throw std::runtime_error(
+            "apply_exposure_gamma_scopes: pixel count does not match " +
+            std::to_string(width) + "x" + std::to_string(height) + "x" +
+            std::to_string(channels));
+    }
+    std::lock_guard<std::mutex> lock(dispatch_mutex);
+    if (lanes.empty()) {
+        return cpu_apply_exposure_gamma_scopes(pixels.data(), width, height,
+                                               channels, exposure, inv_gamma);
+    }
+
+    // Every lane gets at most one band, and each band its own counters
+    float scale = std::exp2(exposure);
+    std::vector<std::vector<unsigned int>> lane_bins(lanes.size());
+    run_bands(pixels.size(), [&](DeviceLane& lane, const WorkBand& band,
+                                 cl::Event& write_event,
+                                 cl::Event& read_event) {
+        lane_bins[band.lane].assign(SCOPE_BUFFER_SIZE, 0);
+        dispatch_scopes_band(lane, band, pixels.data(), width, channels,
+                             scale, inv_gamma, lane_bins[band.lane].data(),
+                             write_event, read_event);
+    });
+
+    std::vector<unsigned int> bins(SCOPE_BUFFER_SIZE, 0);
+    for (const auto& partial : lane_bins) {
+        for (size_t i = 0; i < partial.size(); ++i) {
+            bins[i] += partial[i];
         }
-        std::cerr << "\n";
-        // exit(EXIT_FAILURE);
-        throw std::runtime_error(e.what());
+    }
+    return unpack_scopes(bins);
+}
+
+std::vector<float> ImageProcessor::apply_local_tone_mapping(
+    std::vector<float>& pixels, int width, int height, int channels,
+    float compression, float detail) const {
+    Timer timer("apply_local_tone_mapping");
+    if (width <= 0 || height <= 0 || channels <= 0 ||
+        pixels.size() != static_cast<size_t>(width) * height * channels) {
+        throw std::runtime_error(
+            "apply_local_tone_mapping: pixel count does not match " +
+            std::to_string(width) + "x" + std::to_string(height) + "x" +
+            std::to_string(channels));
+    }
+    std::lock_guard<std::mutex> lock(dispatch_mutex);
+    if (lanes.empty()) {
+        cpu_apply_local_tone_mapping(pixels.data(), width, height, channels,
+                                     compression, detail);
+        return pixels;
     }
 
-    cl::Kernel kernel(program, kernel_name.c_str());
-    kernel.setArg(0, buffer_pixels);
-    kernel.setArg(1, static_cast<unsigned int>(num_pixels));
-    kernel.setArg(2, buffer_params);
-    kernel.setArg(3, static_cast<unsigned int>(parameters.size()));
+    // The grid needs the whole image, so this runs on the fastest lane only;
+    // at preview size the grid is a few thousand cells.
+    DeviceLane& lane = lanes[plan_bands(0).front().lane];
+    LocalToneGrid grid = local_tone_grid(width, height);
+    cl_int err;
 
-    // Execute kernel
-    // size_t global_work_size = modified_pixels.size();
-    err = queue.enqueueNDRangeKernel(kernel, cl::NullRange,
-                                     cl::NDRange(num_pixels), cl::NullRange);
+    // [01] Buffers
+    size_t pixels_bytes = pixels.size() * sizeof(float);
+    if (lane.pixels_capacity < pixels.size()) {
+        lane.pixels_buffer =
+            cl::Buffer(lane.context, CL_MEM_READ_WRITE, pixels_bytes);
+        lane.pixels_capacity = pixels.size();
+    }
+    if (lane.grid_capacity < grid.cells()) {
+        size_t grid_bytes = grid.cells() * 2 * sizeof(float);
+        lane.grid_buffer_a =
+            cl::Buffer(lane.context, CL_MEM_READ_WRITE, grid_bytes);
+        lane.grid_buffer_b =
+            cl::Buffer(lane.context, CL_MEM_READ_WRITE, grid_bytes);
+        lane.grid_capacity = grid.cells();
+    }
+    // Blocking, so a kernel that fails to enqueue below can't leave a
+    // pending read of the host array behind
+    err = lane.queue.enqueueWriteBuffer(lane.pixels_buffer, CL_TRUE, 0,
+                                        pixels_bytes, pixels.data());
     if (err != CL_SUCCESS) {
-        std::cerr << "Error in enqueueNDRangeKernel: " << err << "\n";
-        exit(EXIT_FAILURE);
+        throw std::runtime_error("Error in enqueueWriteBuffer: " +
+                                 std::to_string(err));
     }
-    // Retrieve data
-    err = queue.enqueueReadBuffer(buffer_pixels, CL_TRUE, 0,
-                                  num_pixels * sizeof(float), pixels.data());
+
+    // [02] Splat into grid A, one work-item per grid column
+    const cl::Program& program = lane.program;
+    cl::Kernel splat(program, "ltm_splat");
+    splat.setArg(0, lane.pixels_buffer);
+    splat.setArg(1, static_cast<unsigned int>(width));
+    splat.setArg(2, static_cast<unsigned int>(height));
+    splat.setArg(3, static_cast<unsigned int>(channels));
+    splat.setArg(4, static_cast<unsigned int>(grid.cell_size));
+    splat.setArg(5, static_cast<unsigned int>(grid.width));
+    splat.setArg(6, static_cast<unsigned int>(grid.height));
+    splat.setArg(7, static_cast<unsigned int>(grid.depth));
+    splat.setArg(8, lane.grid_buffer_a);
+    lane.queue.enqueueNDRangeKernel(splat, cl::NullRange,
+                                    cl::NDRange(grid.width, grid.height),
+                                    cl::NullRange);
+
+    // [03] Blur x (A->B), y (B->A), log luminance (A->B)
+    cl::Kernel blur(program, "ltm_blur");
+    blur.setArg(2, static_cast<unsigned int>(grid.width));
+    blur.setArg(3, static_cast<unsigned int>(grid.height));
+    blur.setArg(4, static_cast<unsigned int>(grid.depth));
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        bool forward = axis != 1;
+        blur.setArg(0, forward ? lane.grid_buffer_a : lane.grid_buffer_b);
+        blur.setArg(1, forward ? lane.grid_buffer_b : lane.grid_buffer_a);
+        blur.setArg(5, axis);
+        lane.queue.enqueueNDRangeKernel(blur, cl::NullRange,
+                                        cl::NDRange(grid.cells()),
+                                        cl::NullRange);
+    }
+
+    // [04] Slice grid B back onto every pixel
+    cl::Kernel slice(program, "ltm_slice");
+    slice.setArg(0, lane.pixels_buffer);
+    slice.setArg(1, static_cast<unsigned int>(width));
+    slice.setArg(2, static_cast<unsigned int>(height));
+    slice.setArg(3, static_cast<unsigned int>(channels));
+    slice.setArg(4, static_cast<unsigned int>(grid.cell_size));
+    slice.setArg(5, static_cast<unsigned int>(grid.width));
+    slice.setArg(6, static_cast<unsigned int>(grid.height));
+    slice.setArg(7, static_cast<unsigned int>(grid.depth));
+    slice.setArg(8, lane.grid_buffer_b);
+    slice.setArg(9, compression);
+    slice.setArg(10, detail);
+    lane.queue.enqueueNDRangeKernel(slice, cl::NullRange,
+                                    cl::NDRange(width, height), cl::NullRange);
+
+    err = lane.queue.enqueueReadBuffer(lane.pixels_buffer, CL_TRUE, 0,
+                                       pixels_bytes, pixels.data());
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueReadBuffer: " +
+                                 std::to_string(err));
+    }
+    return pixels;
+}
+
+std::vector<float> ImageProcessor::apply_exposure_gamma_interleave(
+    const PlanarImage& image, float exposure, float inv_gamma) const {
+    Timer timer("apply_exposure_gamma_interleave");
+    std::vector<float> pixels(static_cast<size_t>(image.width) *
+                              image.height * image.channels);
+    if (pixels.empty()) {
+        return pixels;
+    }
+    std::lock_guard<std::mutex> lock(dispatch_mutex);
+    if (lanes.empty()) {
+        cpu_apply_exposure_gamma_interleave(image, exposure, inv_gamma,
+                                            pixels.data());
+        return pixels;
+    }
+
+    // Display-sized images are not worth splitting; run on the fastest lane
+    DeviceLane& lane = lanes[plan_bands(0).front().lane];
+    cl_int err;
+    size_t planes_count = image.plane_stride * image.channels;
+    if (lane.planes_capacity < planes_count) {
+        lane.planes_buffer = cl::Buffer(lane.context, CL_MEM_READ_ONLY,
+                                        planes_count * sizeof(float));
+        lane.planes_capacity = planes_count;
+    }
+    size_t pixels_bytes = pixels.size() * sizeof(float);
+    if (lane.pixels_capacity < pixels.size()) {
+        lane.pixels_buffer =
+            cl::Buffer(lane.context, CL_MEM_READ_WRITE, pixels_bytes);
+        lane.pixels_capacity = pixels.size();
+    }
+    // Blocking, so a failed kernel launch leaves no pending read of `image`
+    err = lane.queue.enqueueWriteBuffer(lane.planes_buffer, CL_TRUE, 0,
+                                        planes_count * sizeof(float),
+                                        image.data.data());
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueWriteBuffer: " +
+                                 std::to_string(err));
+    }
+
+    cl::Kernel kernel(lane.program, "apply_exposure_gamma_interleave");
+    kernel.setArg(0, lane.planes_buffer);
+    kernel.setArg(1, static_cast<unsigned int>(image.width));
+    kernel.setArg(2, static_cast<unsigned int>(image.height));
+    kernel.setArg(3, static_cast<unsigned int>(image.channels));
+    kernel.setArg(4, static_cast<unsigned int>(image.stride));
+    kernel.setArg(5, static_cast<unsigned int>(image.plane_stride));
+    kernel.setArg(6, std::exp2(exposure));
+    kernel.setArg(7, inv_gamma);
+    kernel.setArg(8, lane.pixels_buffer);
+    err = lane.queue.enqueueNDRangeKernel(
+        kernel, cl::NullRange, cl::NDRange(image.width, image.height),
+        cl::NullRange);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("Error in enqueueNDRangeKernel: " +
+                                 std::to_string(err));
+    }
+
+    err = lane.queue.enqueueReadBuffer(lane.pixels_buffer, CL_TRUE, 0,
+                                       pixels_bytes, pixels.data());
     if (err != CL_SUCCESS) {
-        // std::cerr << "Error in enqueueReadBuffer: " << err << "\n";
-        // exit(EXIT_FAILURE);
         throw std::runtime_error("Error in enqueueReadBuffer: " +
                                  std::to_string(err));
     }
-    // Return the modified pixel data
-    // return modified_pixels;
     return pixels;
 }
 
+std::string ImageProcessor::device_report() const {
+    std::lock_guard<std::mutex> lock(dispatch_mutex);
+    std::ostringstream out;
+    if (lanes.empty()) {
+        out << "CPU backend: " << cpu_thread_count() << " threads\n";
+    }
+    for (size_t i = 0; i < lanes.size(); ++i) {
+        const DeviceLane& lane = lanes[i];
+        out << "[" << i << "] " << lane.name
+            << (lane.is_sub_device ? " (sub-device)" : "") << ": ";
+        if (lane.measured) {
+            out << std::fixed << std::setprecision(1) << lane.throughput
+                << " floats/us";
+        } else {
+            out << "not measured yet";
+        }
+        out << "; apply_exposure_gamma: "
+            << (lane.exposure_gamma_variant
+                    ? lane.exposure_gamma_variant->describe()
+                    : std::string("generic kernel"))
+            << "\n";
+    }
+    return out.str();
+}
+
 std::vector<float> ImageProcessor::apply_gamma_correction(
     std::vector<float>& pixels, float inv_gamma) const {
     return apply_kernel(pixels, "apply_gamma", {inv_gamma});
@@ -266,4 +870,25 @@ std::vector<float> ImageProcessor::apply_exposure_correction(
 std::vector<float> ImageProcessor::apply_exposure_gamma_correction(
     std::vector<float>& pixels, float exposure, float inv_gamma) const {
     return apply_kernel(pixels, "apply_exposure_gamma", {exposure, inv_gamma});
+}
+
+void ImageProcessor::apply_exposure_gamma_correction(
+    PlanarImage& image, float exposure, float inv_gamma) const {
+    Timer timer("apply_exposure_gamma_correction (planar)");
+    std::lock_guard<std::mutex> lock(dispatch_mutex);
+    if (image.empty()) {
+        return;
+    }
+    if (lanes.empty()) {
+        cpu_apply_exposure_gamma(image.view(), exposure, inv_gamma);
+        return;
+    }
+
+    std::vector<float> parameters = {exposure, inv_gamma};
+    run_bands(image.data.size(), [&](DeviceLane& lane, const WorkBand& band,
+                                     cl::Event& write_event,
+                                     cl::Event& read_event) {
+        dispatch_band(lane, band, image.data.data(), "apply_exposure_gamma",
+                      parameters, write_event, read_event);
+    });
 }
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include "kernel_tuner.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "timer.h"
+
+// Bump whenever the generated source changes so cached winners are retuned
+constexpr int VARIANTS_VERSION = 1;
+const std::vector<int> VARIANT_VECTOR_WIDTHS = {1, 4, 8};
+const std::vector<int> VARIANT_ITEMS_PER_WORK_ITEM = {1, 2, 4};
+const std::vector<size_t> VARIANT_LOCAL_SIZES = {0, 64, 128, 256};
+// Synthetic benchmark image: 1920x1080 RGB, repeated TUNING_RUNS times
+constexpr size_t TUNING_COUNT = 1920 * 1080 * 3;
+constexpr int TUNING_RUNS = 3;
+
+std::string KernelVariant::entry_point() const {
+    return "apply_exposure_gamma_w" + std::to_string(vector_width) + "_i" +
+           std::to_string(items_per_work_item);
+}
+
+std::string KernelVariant::describe() const {
+    std::ostringstream out;
+    out << (vector_width == 1 ? "float" : "float" + std::to_string(vector_width))
+        << " x" << items_per_work_item << ", local "
+        << (local_size == 0 ? std::string("auto") : std::to_string(local_size));
+    if (micros > 0.0) {
+        out << " (" << static_cast<long>(micros) << " us)";
+    }
+    return out.str();
+}
+
+std::string exposure_gamma_variants_source() {
+    std::ostringstream src;
+    for (int width : VARIANT_VECTOR_WIDTHS) {
+        for (int items : VARIANT_ITEMS_PER_WORK_ITEM) {
+            KernelVariant variant;
+            variant.vector_width = width;
+            variant.items_per_work_item = items;
+            std::string w = std::to_string(width);
+            std::string type = "float" + w;
+
+            // Items are strided by the global size so that neighbouring
+            // work-items still touch neighbouring memory.
+            src << "__kernel void " << variant.entry_point() << "(\n"
+                << "    __global float* pixels,\n"
+                << "    const unsigned int count,\n"
+                << "    const float scale,\n"
+                << "    const float inv_gamma)\n"
+                << "{\n"
+                << "    for (int k = 0; k < " << items << "; ++k) {\n"
+                << "        size_t i = get_global_id(0) + k * "
+                   "get_global_size(0);\n";
+            if (width == 1) {
+                src << "        if (i < count) {\n"
+                    << "            pixels[i] = pow(pixels[i] * scale, "
+                       "inv_gamma);\n"
+                    << "        }\n";
+            } else {
+                src << "        if (i * " << w << " + " << w
+                    << " <= count) {\n"
+                    << "            " << type << " v = vload" << w
+                    << "(i, pixels);\n"
+                    << "            vstore" << w << "(pow(v * scale, ("
+                    << type << ")(inv_gamma)), i, pixels);\n"
+                    << "        } else if (i * " << w << " < count) {\n"
+                    << "            for (size_t j = i * " << w
+                    << "; j < count; ++j) {\n"
+                    << "                pixels[j] = pow(pixels[j] * scale, "
+                       "inv_gamma);\n"
+                    << "            }\n"
+                    << "        }\n";
+            }
+            src << "    }\n"
+                << "}\n\n";
+        }
+    }
+    return src.str();
+}
+
+cl_int enqueue_exposure_gamma(const cl::CommandQueue& queue,
+                              const cl::Program& program,
+                              const KernelVariant& variant,
+                              const cl::Buffer& pixels, size_t count,
+                              float scale, float inv_gamma,
+                              cl::Event* event) {
+    size_t width = static_cast<size_t>(variant.vector_width);
+    size_t items = static_cast<size_t>(variant.items_per_work_item);
+    size_t vectors = (count + width - 1) / width;
+    size_t global_size = (vectors + items - 1) / items;
+    if (variant.local_size > 0) {
+        // OpenCL 1.2 requires the global size to be a multiple of the
+        // local size; the extra work-items fail the bounds check.
+        global_size = (global_size + variant.local_size - 1) /
+                      variant.local_size * variant.local_size;
+    }
+
+    cl::Kernel kernel(program, variant.entry_point().c_str());
+    kernel.setArg(0, pixels);
+    kernel.setArg(1, static_cast<unsigned int>(count));
+    kernel.setArg(2, scale);
+    kernel.setArg(3, inv_gamma);
+    return queue.enqueueNDRangeKernel(
+        kernel, cl::NullRange, cl::NDRange(global_size),
+        variant.local_size > 0 ? cl::NDRange(variant.local_size)
+                               : cl::NullRange,
+        nullptr, event);
+}
+
+// True if exposure_gamma_variants_source() generates this variant's entry
+// point and the tuner would have tried its local size
+static bool is_generated_variant(const KernelVariant& variant) {
+    auto generated = [](const auto& values, auto value) {
+        return std::find(values.begin(), values.end(), value) != values.end();
+    };
+    return generated(VARIANT_VECTOR_WIDTHS, variant.vector_width) &&
+           generated(VARIANT_ITEMS_PER_WORK_ITEM,
+                     variant.items_per_work_item) &&
+           generated(VARIANT_LOCAL_SIZES, variant.local_size);
+}
+
+static std::string default_tuning_cache_path() {
+    if (const char* path = std::getenv("HDR_VIEWER_TUNING_CACHE")) {
+        return path;
+    }
+    std::filesystem::path base;
+#ifdef _WIN32
+    if (const char* local = std::getenv("LOCALAPPDATA")) {
+        base = local;
+    }
+#else
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+        base = xdg;
+    } else if (const char* home = std::getenv("HOME")) {
+        base = std::filesystem::path(home) / ".cache";
+    }
+#endif
+    if (base.empty()) {
+        return "";
+    }
+    return (base / "hdr-viewer" / "kernel_tuning.txt").string();
+}
+
+static std::string tuning_key(const cl::Device& device) {
+    return device.getInfo<CL_DEVICE_NAME>() + "|" +
+           device.getInfo<CL_DEVICE_VENDOR>() + "|" +
+           device.getInfo<CL_DRIVER_VERSION>() + "|v" +
+           std::to_string(VARIANTS_VERSION);
+}
+
+KernelTuner::KernelTuner() : KernelTuner(default_tuning_cache_path()) {}
+
+KernelTuner::KernelTuner(const std::string& cache_path)
+    : cache_path(cache_path) {
+    load();
+}
+
+KernelVariant KernelTuner::select(const cl::Context& context,
+                                  const cl::Device& device,
+                                  const cl::CommandQueue& queue,
+                                  const cl::Program& program) {
+    std::string key = tuning_key(device);
+    auto cached = winners.find(key);
+    if (cached != winners.end()) {
+        // A cached work-group size the kernel can't run with is retuned
+        const KernelVariant& variant = cached->second;
+        cl::Kernel kernel(program, variant.entry_point().c_str());
+        if (variant.local_size <=
+            kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)) {
+            return variant;
+        }
+    }
+    KernelVariant winner = benchmark(context, device, queue, program);
+    winners[key] = winner;
+    save();
+    return winner;
+}
+
+KernelVariant KernelTuner::benchmark(const cl::Context& context,
+                                     const cl::Device& device,
+                                     const cl::CommandQueue& queue,
+                                     const cl::Program& program) const {
+    Timer timer("tune apply_exposure_gamma: " +
+                device.getInfo<CL_DEVICE_NAME>());
+
+    // [01] Synthetic image: a ramp over [0, 4) like a normalized HDR preview
+    std::vector<float> synthetic(TUNING_COUNT);
+    for (size_t i = 0; i < synthetic.size(); ++i) {
+        synthetic[i] = 4.0f * static_cast<float>(i % 4096) / 4096.0f;
+    }
+    cl::Buffer buffer(context, CL_MEM_READ_WRITE,
+                      synthetic.size() * sizeof(float));
+    queue.enqueueWriteBuffer(buffer, CL_TRUE, 0,
+                             synthetic.size() * sizeof(float),
+                             synthetic.data());
+
+    // [02] Time every variant the device can run; keep the fastest
+    KernelVariant best;
+    best.micros = -1.0;
+    for (int width : VARIANT_VECTOR_WIDTHS) {
+        for (int items : VARIANT_ITEMS_PER_WORK_ITEM) {
+            KernelVariant variant;
+            variant.vector_width = width;
+            variant.items_per_work_item = items;
+            cl::Kernel kernel(program, variant.entry_point().c_str());
+            size_t max_local =
+                kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+
+            for (size_t local_size : VARIANT_LOCAL_SIZES) {
+                if (local_size > max_local) {
+                    continue;
+                }
+                variant.local_size = local_size;
+                double fastest = -1.0;
+                // The first run warms up caches and the driver's JIT
+                for (int run = 0; run <= TUNING_RUNS; ++run) {
+                    cl::Event event;
+                    enqueue_exposure_gamma(queue, program, variant, buffer,
+                                           TUNING_COUNT, 1.0f, 1.0f / 2.2f,
+                                           &event);
+                    event.wait();
+                    if (run == 0) {
+                        continue;
+                    }
+                    cl_ulong start =
+                        event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+                    cl_ulong end =
+                        event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+                    double micros = static_cast<double>(end - start) / 1000.0;
+                    if (fastest < 0.0 || micros < fastest) {
+                        fastest = micros;
+                    }
+                }
+                variant.micros = fastest;
+                if (best.micros < 0.0 || variant.micros < best.micros) {
+                    best = variant;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+void KernelTuner::load() {
+    if (cache_path.empty()) {
+        return;
+    }
+    std::ifstream file(cache_path);
+    std::string line;
+    // key \t vector_width \t items_per_work_item \t local_size \t micros
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        KernelVariant variant;
+        if (std::getline(fields, key, '\t') && fields >> variant.vector_width >>
+                                                   variant.items_per_work_item >>
+                                                   variant.local_size >>
+                                                   variant.micros) {
+            // Entries that don't name a generated variant (a hand-edited or
+            // corrupt cache) are dropped and the device is retuned
+            if (is_generated_variant(variant)) {
+                winners[key] = variant;
+            }
+        }
+    }
+}
+
+void KernelTuner::save() const {
+    if (cache_path.empty()) {
+        return;
+    }
+    try {
+        std::filesystem::path path(cache_path);
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+        std::ofstream file(cache_path, std::ios::trunc);
+        for (const auto& pair : winners) {
+            const KernelVariant& variant = pair.second;
+            file << pair.first << '\t' << variant.vector_width << '\t'
+                 << variant.items_per_work_item << '\t' << variant.local_size
+                 << '\t' << variant.micros << '\n';
+        }
+    } catch (const std::exception& e) {
+        // Tuning results are only a cache; the next run will retune
+        std::cerr << "Could not write kernel tuning cache " << cache_path
+                  << ": " << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,343 @@
+#include "local_tone_mapping.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "cpu_backend.h"
+#include "timer.h"
+
+LocalToneGrid local_tone_grid(int image_width, int image_height) {
+    LocalToneGrid grid;
+    grid.cell_size = std::max(8, image_width / 64);
+    // Splatting rounds to the nearest cell and slicing reads cell + 1
+    grid.width = (image_width - 1) / grid.cell_size + 2;
+    grid.height = (image_height - 1) / grid.cell_size + 2;
+    grid.depth = LTM_GRID_DEPTH;
+    return grid;
+}
+
+// Pixels sliced per pass of the CPU slice loop
+constexpr int LTM_SLICE_BLOCK = 16;
+
+// Keep the helpers below in sync with local_tone_mapping_kernel_source()
+static float ltm_log_luma(const float* px, int channels) {
+    float luma = channels >= 3
+                     ? 0.2126f * px[0] + 0.7152f * px[1] + 0.0722f * px[2]
+                     : px[0];
+    // fmax also maps NaN to the floor
+    return std::log2(std::fmax(luma, std::exp2(LTM_LOG_MIN)));
+}
+
+static float ltm_depth_coordinate(float log_luma) {
+    return (std::fmin(log_luma, LTM_LOG_MAX) - LTM_LOG_MIN) / LTM_RANGE_SIGMA;
+}
+
+// Base layer from the sliced (value, weight) sum. The small bias replaces a
+// branch on empty cells: it falls back to the pixel's own log luminance
+// where nothing was splatted and vanishes elsewhere.
+static float ltm_base(float value, float weight, float log_luma) {
+    return (value + 1e-6f * log_luma) / (weight + 1e-6f);
+}
+
+// 3-tap [1 2 1] blur of the (value, weight) grid along one axis
+static void ltm_blur(const std::vector<float>& src, std::vector<float>& dst,
+                     const LocalToneGrid& grid, int axis) {
+    size_t stride = axis == 0   ? 1
+                    : axis == 1 ? static_cast<size_t>(grid.width)
+                                : static_cast<size_t>(grid.width) * grid.height;
+    int extent = axis == 0 ? grid.width : axis == 1 ? grid.height : grid.depth;
+    parallel_ranges(grid.cells(), [&](size_t begin, size_t end,
+                                      unsigned int) {
+        for (size_t cell = begin; cell < end; ++cell) {
+            int position = static_cast<int>(cell / stride % extent);
+            size_t previous = position > 0 ? cell - stride : cell;
+            size_t next = position < extent - 1 ? cell + stride : cell;
+            for (int k = 0; k < 2; ++k) {
+                dst[cell * 2 + k] =
+                    0.25f * src[previous * 2 + k] + 0.5f * src[cell * 2 + k] +
+                    0.25f * src[next * 2 + k];
+            }
+        }
+    });
+}
+
+void cpu_apply_local_tone_mapping(float* pixels, int width, int height,
+                                  int channels, float compression,
+                                  float detail) {
+    Timer timer("cpu_apply_local_tone_mapping");
+    LocalToneGrid grid = local_tone_grid(width, height);
+    int s = grid.cell_size;
+    size_t plane = static_cast<size_t>(grid.width) * grid.height;
+    std::vector<float> grid_a(grid.cells() * 2, 0.0f);
+    std::vector<float> grid_b(grid.cells() * 2, 0.0f);
+
+    // [01] Splat: every thread owns whole rows of grid cells, and so the
+    // image rows that round to them; no two threads touch the same cell
+    parallel_ranges(grid.height, [&](size_t begin, size_t end, unsigned int) {
+        for (int cy = static_cast<int>(begin); cy < static_cast<int>(end);
+             ++cy) {
+            int first_row = std::max(0, cy * s - s / 2);
+            int last_row = std::min(height, cy * s + s - s / 2);
+            for (int y = first_row; y < last_row; ++y) {
+                const float* row = pixels + static_cast<size_t>(y) * width *
+                                                channels;
+                for (int x = 0; x < width; ++x) {
+                    float log_luma = ltm_log_luma(row + x * channels, channels);
+                    int cx = (x + s / 2) / s;
+                    int cz = static_cast<int>(
+                        ltm_depth_coordinate(log_luma) + 0.5f);
+                    size_t cell = cz * plane +
+                                  static_cast<size_t>(cy) * grid.width + cx;
+                    grid_a[cell * 2] += log_luma;
+                    grid_a[cell * 2 + 1] += 1.0f;
+                }
+            }
+        }
+    });
+
+    // [02] Blur along x, y and log luminance; the result ends up in grid_b
+    ltm_blur(grid_a, grid_b, grid, 0);
+    ltm_blur(grid_b, grid_a, grid, 1);
+    ltm_blur(grid_a, grid_b, grid, 2);
+
+    // [03] Slice: trilinear lookup of the base layer, then rescale the
+    // colour channels by the change in log luminance. The grid is first
+    // interpolated to the current row, leaving a bilinear (x, log luminance)
+    // lookup per pixel. Pixels go through it in blocks, one short loop per
+    // step, so every step but log2/exp2 compiles to vector code.
+    int color_channels = std::min(channels, 3);
+    float inv_cell = 1.0f / static_cast<float>(s);
+    std::vector<int> column_cell(width);
+    std::vector<float> column_weight(width);
+    for (int x = 0; x < width; ++x) {
+        column_cell[x] = x / s;
+        column_weight[x] = static_cast<float>(x % s) * inv_cell;
+    }
+    size_t row_cells = static_cast<size_t>(grid.width) * grid.depth;
+    parallel_ranges(height, [&](size_t begin, size_t end, unsigned int) {
+        // (log luminance, x) planes of the grid at the current row
+        std::vector<float> row_value(row_cells);
+        std::vector<float> row_weight(row_cells);
+        float log_luma[LTM_SLICE_BLOCK];
+        float wz[LTM_SLICE_BLOCK];
+        float corners[8][LTM_SLICE_BLOCK];
+        float gain[LTM_SLICE_BLOCK];
+        for (size_t y = begin; y < end; ++y) {
+            int y0 = static_cast<int>(y) / s;
+            float wy = static_cast<float>(static_cast<int>(y) % s) * inv_cell;
+            for (int z = 0; z < grid.depth; ++z) {
+                const float* top = grid_b.data() +
+                                   (z * plane +
+                                    static_cast<size_t>(y0) * grid.width) *
+                                       2;
+                const float* bottom = top + grid.width * 2;
+                float* value = row_value.data() +
+                               static_cast<size_t>(z) * grid.width;
+                float* weight = row_weight.data() +
+                                static_cast<size_t>(z) * grid.width;
+                for (int x = 0; x < grid.width; ++x) {
+                    value[x] = top[x * 2] + wy * (bottom[x * 2] - top[x * 2]);
+                    weight[x] = top[x * 2 + 1] +
+                                wy * (bottom[x * 2 + 1] - top[x * 2 + 1]);
+                }
+            }
+
+            float* row = pixels + y * width * channels;
+            for (int first = 0; first < width; first += LTM_SLICE_BLOCK) {
+                int count = std::min(LTM_SLICE_BLOCK, width - first);
+                float* px = row + static_cast<size_t>(first) * channels;
+                const float* wx = column_weight.data() + first;
+                for (int i = 0; i < count; ++i) {
+                    log_luma[i] = ltm_log_luma(px + i * channels, channels);
+                }
+                // Gather the four (x, log luminance) corners of every pixel
+                for (int i = 0; i < count; ++i) {
+                    float fz = ltm_depth_coordinate(log_luma[i]);
+                    int z0 = std::min(static_cast<int>(fz), grid.depth - 2);
+                    wz[i] = fz - static_cast<float>(z0);
+                    size_t low = static_cast<size_t>(z0) * grid.width +
+                                 column_cell[first + i];
+                    size_t high = low + grid.width;
+                    corners[0][i] = row_value[low];
+                    corners[1][i] = row_value[low + 1];
+                    corners[2][i] = row_value[high];
+                    corners[3][i] = row_value[high + 1];
+                    corners[4][i] = row_weight[low];
+                    corners[5][i] = row_weight[low + 1];
+                    corners[6][i] = row_weight[high];
+                    corners[7][i] = row_weight[high + 1];
+                }
+                // Straight-line arithmetic on contiguous arrays: this is the
+                // loop that vectorizes
+                for (int i = 0; i < count; ++i) {
+                    float value_low =
+                        corners[0][i] + wx[i] * (corners[1][i] - corners[0][i]);
+                    float value_high =
+                        corners[2][i] + wx[i] * (corners[3][i] - corners[2][i]);
+                    float weight_low =
+                        corners[4][i] + wx[i] * (corners[5][i] - corners[4][i]);
+                    float weight_high =
+                        corners[6][i] + wx[i] * (corners[7][i] - corners[6][i]);
+                    float value = value_low + wz[i] * (value_high - value_low);
+                    float weight =
+                        weight_low + wz[i] * (weight_high - weight_low);
+                    float base = ltm_base(value, weight, log_luma[i]);
+                    float mapped = compression * base +
+                                   detail * (log_luma[i] - base);
+                    gain[i] = mapped - log_luma[i];
+                }
+                for (int i = 0; i < count; ++i) {
+                    gain[i] = std::exp2(gain[i]);
+                }
+                for (int i = 0; i < count; ++i) {
+                    for (int c = 0; c < color_channels; ++c) {
+                        px[i * channels + c] *= gain[i];
+                    }
+                }
+            }
+        }
+    });
+}
+
+std::string local_tone_mapping_kernel_source() {
+    std::string defines =
+        "#define LTM_LOG_MIN " + std::to_string(LTM_LOG_MIN) + "f\n" +
+        "#define LTM_LOG_MAX " + std::to_string(LTM_LOG_MAX) + "f\n" +
+        "#define LTM_RANGE_SIGMA " + std::to_string(LTM_RANGE_SIGMA) + "f\n";
+
+    return defines + R"(
+        float ltm_log_luma(__global const float* px, uint channels) {
+            float luma = channels >= 3
+                ? 0.2126f * px[0] + 0.7152f * px[1] + 0.0722f * px[2]
+                : px[0];
+            return log2(fmax(luma, exp2(LTM_LOG_MIN)));
+        }
+
+        float ltm_depth_coordinate(float log_luma) {
+            return (fmin(log_luma, LTM_LOG_MAX) - LTM_LOG_MIN) /
+                   LTM_RANGE_SIGMA;
+        }
+
+        float ltm_base(float value, float weight, float log_luma) {
+            return (value + 1e-6f * log_luma) / (weight + 1e-6f);
+        }
+
+        // One work-item per (x, y) grid column gathers the pixels that round
+        // to it, so no float atomics are needed
+        __kernel void ltm_splat(
+            __global const float* pixels,
+            const uint width,
+            const uint height,
+            const uint channels,
+            const uint cell_size,
+            const uint grid_width,
+            const uint grid_height,
+            const uint grid_depth,
+            __global float2* grid)
+        {
+            uint cx = get_global_id(0);
+            uint cy = get_global_id(1);
+            if (cx >= grid_width || cy >= grid_height) {
+                return;
+            }
+            uint plane = grid_width * grid_height;
+            for (uint z = 0; z < grid_depth; ++z) {
+                grid[z * plane + cy * grid_width + cx] = (float2)(0.0f);
+            }
+
+            int half_cell = cell_size / 2;
+            int first_x = max(0, (int)(cx * cell_size) - half_cell);
+            int last_x = min((int)width,
+                             (int)(cx * cell_size + cell_size) - half_cell);
+            int first_y = max(0, (int)(cy * cell_size) - half_cell);
+            int last_y = min((int)height,
+                             (int)(cy * cell_size + cell_size) - half_cell);
+            for (int y = first_y; y < last_y; ++y) {
+                for (int x = first_x; x < last_x; ++x) {
+                    float log_luma = ltm_log_luma(
+                        pixels + ((size_t)y * width + x) * channels, channels);
+                    uint cz = (uint)(ltm_depth_coordinate(log_luma) + 0.5f);
+                    grid[cz * plane + cy * grid_width + cx] +=
+                        (float2)(log_luma, 1.0f);
+                }
+            }
+        }
+
+        // 3-tap [1 2 1] blur along axis 0 (x), 1 (y) or 2 (log luminance)
+        __kernel void ltm_blur(
+            __global const float2* src,
+            __global float2* dst,
+            const uint grid_width,
+            const uint grid_height,
+            const uint grid_depth,
+            const uint axis)
+        {
+            uint cell = get_global_id(0);
+            uint plane = grid_width * grid_height;
+            if (cell >= plane * grid_depth) {
+                return;
+            }
+            uint stride = axis == 0 ? 1 : axis == 1 ? grid_width : plane;
+            uint extent = axis == 0 ? grid_width
+                        : axis == 1 ? grid_height : grid_depth;
+            uint position = cell / stride % extent;
+            uint previous = position > 0 ? cell - stride : cell;
+            uint next = position < extent - 1 ? cell + stride : cell;
+            dst[cell] = 0.25f * src[previous] + 0.5f * src[cell] +
+                        0.25f * src[next];
+        }
+
+        __kernel void ltm_slice(
+            __global float* pixels,
+            const uint width,
+            const uint height,
+            const uint channels,
+            const uint cell_size,
+            const uint grid_width,
+            const uint grid_height,
+            const uint grid_depth,
+            __global const float2* grid,
+            const float compression,
+            const float detail)
+        {
+            uint x = get_global_id(0);
+            uint y = get_global_id(1);
+            if (x >= width || y >= height) {
+                return;
+            }
+            __global float* px = pixels + ((size_t)y * width + x) * channels;
+            float log_luma = ltm_log_luma(px, channels);
+
+            float fx = (float)x / (float)cell_size;
+            float fy = (float)y / (float)cell_size;
+            float fz = ltm_depth_coordinate(log_luma);
+            int x0 = (int)fx;
+            int y0 = (int)fy;
+            int z0 = min((int)fz, (int)grid_depth - 2);
+            float wx = fx - x0;
+            float wy = fy - y0;
+            float wz = fz - z0;
+
+            uint plane = grid_width * grid_height;
+            float2 sum = (float2)(0.0f);
+            for (int corner = 0; corner < 8; ++corner) {
+                int dx = corner & 1;
+                int dy = (corner >> 1) & 1;
+                int dz = corner >> 2;
+                float w = (dx ? wx : 1.0f - wx) * (dy ? wy : 1.0f - wy) *
+                          (dz ? wz : 1.0f - wz);
+                sum += w * grid[(z0 + dz) * plane + (y0 + dy) * grid_width +
+                                x0 + dx];
+            }
+            float base = ltm_base(sum.x, sum.y, log_luma);
+            float mapped = compression * base + detail * (log_luma - base);
+            float gain = exp2(mapped - log_luma);
+            uint color_channels = min(channels, 3u);
+            for (uint c = 0; c < color_channels; ++c) {
+                px[c] *= gain;
+            }
+        }
+    )";
+}
@@ -1,4 +1,5 @@
 #include <cmath>  // for std::round
+#include <cstdlib>
 #include <filesystem>
 #include <iomanip>  // Include for std::setprecision
 #include <iostream>
@@ -6,12 +7,12 @@
 #include <string>
 #include <vector>
 
+#include "image_compare.h"
 #include "image_io.h"
 #include "image_processing.h"
 
 namespace fs = std::filesystem;
 int NEW_WIDTH = 1024;
-ImageProcessor imageProcessor;
 
 std::string format_dynamic_range(float dynamic_range) {
     std::ostringstream out;
@@ -53,7 +54,102 @@ void print_info(float dynamic_range, float stops) {
               << " (" << quality << ")\n";
 }
 
-int main() {
+void print_comparison(const std::string& reference_path,
+                      const std::string& test_path,
+                      const CompareResult& result) {
+    std::cout << (result.passed ? "PASS " : "FAIL ") << test_path << " vs "
+              << reference_path << "\n";
+    if (!result.error.empty()) {
+        std::cout << "  " << result.error << "\n";
+        return;
+    }
+    std::cout << std::setprecision(6) << "  max abs: " << result.max_abs_error
+              << " / RMSE: " << result.rmse << " / PSNR: " << std::fixed
+              << std::setprecision(2) << result.psnr << " dB\n"
+              << "  different pixels: " << result.pixels_different << " of "
+              << result.pixels_compared
+              << (result.stopped_early ? " (stopped early)" : "") << "\n";
+    std::cout << std::defaultfloat << std::setprecision(6);
+    for (int c = 0; c < result.channels; ++c) {
+        std::cout << "  channel " << c
+                  << ": max abs: " << result.channel_max_abs_error[c]
+                  << " / RMSE: " << result.channel_rmse[c] << "\n";
+    }
+}
+
+// Image_Processing compare <reference> <test> [options]
+//   --sequence          both paths are first frames of sequences
+//   --threshold T       error above which a pixel is different (1e-3)
+//   --max-error E       fail when any value is off by more than E
+//   --fail-fraction F   fail when more than F of the pixels differ (0)
+//   --full              finish the comparison after a failure
+//   --mask PATH         write the diff mask of a single-image comparison
+// Exits with 0 when everything matches, 1 on a difference and 2 on misuse.
+int run_compare(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0]
+                  << " compare <reference> <test> [--sequence] [--threshold T]"
+                     " [--max-error E] [--fail-fraction F] [--full]"
+                     " [--mask PATH]"
+                  << std::endl;
+        return 2;
+    }
+    std::string reference_path = argv[2];
+    std::string test_path = argv[3];
+    CompareOptions options;
+    bool sequence = false;
+    std::string mask_path;
+    for (int i = 4; i < argc; ++i) {
+        std::string option = argv[i];
+        bool has_value = i + 1 < argc;
+        if (option == "--sequence") {
+            sequence = true;
+        } else if (option == "--full") {
+            options.early_exit = false;
+        } else if (option == "--threshold" && has_value) {
+            options.pixel_threshold = std::strtof(argv[++i], nullptr);
+        } else if (option == "--max-error" && has_value) {
+            options.max_abs_limit = std::strtof(argv[++i], nullptr);
+        } else if (option == "--fail-fraction" && has_value) {
+            options.fail_fraction = std::strtod(argv[++i], nullptr);
+        } else if (option == "--mask" && has_value) {
+            mask_path = argv[++i];
+        } else {
+            std::cerr << "Unknown or incomplete option: " << option
+                      << std::endl;
+            return 2;
+        }
+    }
+    options.build_mask = !mask_path.empty() && !sequence;
+
+    if (sequence) {
+        std::vector<FrameComparison> frames =
+            compare_sequences(reference_path, test_path, options);
+        size_t failures = 0;
+        for (const auto& frame : frames) {
+            print_comparison(frame.reference_path, frame.test_path,
+                             frame.result);
+            failures += frame.result.passed ? 0 : 1;
+        }
+        std::cout << frames.size() - failures << " of " << frames.size()
+                  << " frames match" << std::endl;
+        return failures == 0 ? 0 : 1;
+    }
+
+    CompareResult result = compare_images(reference_path, test_path, options);
+    print_comparison(reference_path, test_path, result);
+    if (options.build_mask && result.error.empty()) {
+        std::vector<float> mask(result.diff_mask.begin(),
+                                result.diff_mask.end());
+        write_image(mask_path, mask, result.width, result.height, 1);
+    }
+    return result.passed ? 0 : 1;
+}
+
+int process_examples() {
+    // Only built here: comparisons run on the CPU and don't need OpenCL
+    ImageProcessor imageProcessor;
+
     // Directory containing the image files
     std::string directory_path = "examples";
 
@@ -108,4 +204,11 @@ int main() {
                   << "\n-----------------" << std::endl;
     }
     return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "compare") {
+        return run_compare(argc, argv);
+    }
+    return process_examples();
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "planar_image.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+PlanarImage::PlanarImage(int width, int height, int channels)
+    : width(width), height(height), channels(channels) {
+    stride = (static_cast<size_t>(width) + PLANE_ALIGNMENT_FLOATS - 1) /
+             PLANE_ALIGNMENT_FLOATS * PLANE_ALIGNMENT_FLOATS;
+    plane_stride = stride * height;
+    data.assign(plane_stride * channels, 0.0f);
+}
+
+PlanarImage to_planar(const std::vector<float>& pixels, int width, int height,
+                      int channels) {
+    size_t expected = static_cast<size_t>(std::max(width, 0)) *
+                      std::max(height, 0) * std::max(channels, 0);
+    if (expected == 0 || pixels.size() != expected) {
+        throw std::runtime_error("to_planar: pixel count does not match " +
+                                 std::to_string(width) + "x" +
+                                 std::to_string(height) + "x" +
+                                 std::to_string(channels));
+    }
+    PlanarImage image(width, height, channels);
+    for (int y = 0; y < height; ++y) {
+        const float* src = pixels.data() + static_cast<size_t>(y) * width *
+                                               channels;
+        for (int c = 0; c < channels; ++c) {
+            float* dst = image.row(c, y);
+            for (int x = 0; x < width; ++x) {
+                dst[x] = src[x * channels + c];
+            }
+        }
+    }
+    return image;
+}
+
+std::vector<float> to_interleaved(const PlanarImage& image) {
+    std::vector<float> pixels(static_cast<size_t>(image.width) * image.height *
+                              image.channels);
+    for (int y = 0; y < image.height; ++y) {
+        float* dst = pixels.data() + static_cast<size_t>(y) * image.width *
+                                         image.channels;
+        for (int c = 0; c < image.channels; ++c) {
+            const float* src = image.row(c, y);
+            for (int x = 0; x < image.width; ++x) {
+                dst[x * image.channels + c] = src[x];
+            }
+        }
+    }
+    return pixels;
+}
+
+std::string planar_kernel_source() {
+    return R"(
+        // One work-item per pixel reads its value from every plane and
+        // writes the tone-mapped pixel interleaved
+        __kernel void apply_exposure_gamma_interleave(
+            __global const float* planes,
+            const uint width,
+            const uint height,
+            const uint channels,
+            const uint stride,
+            const uint plane_stride,
+            const float scale,
+            const float inv_gamma,
+            __global float* pixels)
+        {
+            uint x = get_global_id(0);
+            uint y = get_global_id(1);
+            if (x >= width || y >= height) {
+                return;
+            }
+            size_t source = (size_t)y * stride + x;
+            size_t target = ((size_t)y * width + x) * channels;
+            for (uint c = 0; c < channels; ++c) {
+                pixels[target + c] = pow(
+                    planes[c * (size_t)plane_stride + source] * scale,
+                    inv_gamma);
+            }
+        }
+    )";
+}
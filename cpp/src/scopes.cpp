@@ -0,0 +1,145 @@
+#include "scopes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+ScopeData unpack_scopes(const std::vector<unsigned int>& bins) {
+    auto begin = bins.begin();
+    ScopeData scopes;
+    scopes.luma_histogram.assign(begin, begin + SCOPE_RGB_OFFSET);
+    scopes.rgb_histogram.assign(begin + SCOPE_RGB_OFFSET,
+                                begin + SCOPE_WAVEFORM_OFFSET);
+    scopes.waveform.assign(begin + SCOPE_WAVEFORM_OFFSET,
+                           begin + SCOPE_VECTORSCOPE_OFFSET);
+    scopes.vectorscope.assign(begin + SCOPE_VECTORSCOPE_OFFSET,
+                              begin + SCOPE_BUFFER_SIZE);
+    return scopes;
+}
+
+// Keep in sync with bin_pixel in scopes_kernel_source()
+static int scope_bin(float value, int bins) {
+    return std::clamp(static_cast<int>(value * static_cast<float>(bins)), 0,
+                      bins - 1);
+}
+
+void accumulate_scopes(const float* pixels, size_t first_pixel,
+                       size_t pixel_count, int width, int channels,
+                       unsigned int* bins) {
+    for (size_t p = 0; p < pixel_count; ++p) {
+        const float* px = pixels + p * channels;
+        // fmax/fmin also map NaN (pow of a negative value) to black
+        float r = std::fmin(std::fmax(px[0], 0.0f), 1.0f);
+        float g = r;
+        float b = r;
+        if (channels >= 3) {
+            g = std::fmin(std::fmax(px[1], 0.0f), 1.0f);
+            b = std::fmin(std::fmax(px[2], 0.0f), 1.0f);
+        }
+        float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+
+        bins[scope_bin(y, HISTOGRAM_BINS)]++;
+        bins[SCOPE_RGB_OFFSET + scope_bin(r, HISTOGRAM_BINS)]++;
+        bins[SCOPE_RGB_OFFSET + HISTOGRAM_BINS +
+             scope_bin(g, HISTOGRAM_BINS)]++;
+        bins[SCOPE_RGB_OFFSET + 2 * HISTOGRAM_BINS +
+             scope_bin(b, HISTOGRAM_BINS)]++;
+
+        size_t x = (first_pixel + p) % static_cast<size_t>(width);
+        size_t column = x * WAVEFORM_COLUMNS / static_cast<size_t>(width);
+        bins[SCOPE_WAVEFORM_OFFSET +
+             scope_bin(y, WAVEFORM_LEVELS) * WAVEFORM_COLUMNS + column]++;
+
+        float cb = (b - y) / 1.8556f + 0.5f;
+        float cr = (r - y) / 1.5748f + 0.5f;
+        bins[SCOPE_VECTORSCOPE_OFFSET +
+             scope_bin(cr, VECTORSCOPE_SIZE) * VECTORSCOPE_SIZE +
+             scope_bin(cb, VECTORSCOPE_SIZE)]++;
+    }
+}
+
+std::string scopes_kernel_source() {
+    std::string defines =
+        "#define HISTOGRAM_BINS " + std::to_string(HISTOGRAM_BINS) + "\n" +
+        "#define WAVEFORM_COLUMNS " + std::to_string(WAVEFORM_COLUMNS) + "\n" +
+        "#define WAVEFORM_LEVELS " + std::to_string(WAVEFORM_LEVELS) + "\n" +
+        "#define VECTORSCOPE_SIZE " + std::to_string(VECTORSCOPE_SIZE) + "\n" +
+        "#define SCOPE_RGB_OFFSET " + std::to_string(SCOPE_RGB_OFFSET) + "\n" +
+        "#define SCOPE_WAVEFORM_OFFSET " +
+        std::to_string(SCOPE_WAVEFORM_OFFSET) + "\n" +
+        "#define SCOPE_VECTORSCOPE_OFFSET " +
+        std::to_string(SCOPE_VECTORSCOPE_OFFSET) + "\n";
+
+    // The four histograms (4 KB) are accumulated with work-group-local
+    // atomics and merged into global memory once per group. The waveform and
+    // vectorscope are too large for local memory, but their counters are
+    // spread out enough that global atomics rarely collide.
+    return defines + R"(
+        int bin_pixel(float value, int bins) {
+            return clamp((int)(value * (float)bins), 0, bins - 1);
+        }
+
+        __kernel void apply_exposure_gamma_scopes(
+            __global float* pixels,
+            const unsigned int pixel_count,
+            const unsigned int channels,
+            const unsigned int width,
+            const unsigned int first_pixel,
+            const float scale,
+            const float inv_gamma,
+            __global unsigned int* scopes)
+        {
+            __local unsigned int histograms[SCOPE_WAVEFORM_OFFSET];
+            for (uint i = get_local_id(0); i < SCOPE_WAVEFORM_OFFSET;
+                 i += get_local_size(0)) {
+                histograms[i] = 0;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            // No early return: every work-item has to reach the barriers
+            uint p = get_global_id(0);
+            if (p < pixel_count) {
+                __global float* px = pixels + p * channels;
+                for (uint c = 0; c < channels; ++c) {
+                    px[c] = pow(px[c] * scale, inv_gamma);
+                }
+
+                float r = fmin(fmax(px[0], 0.0f), 1.0f);
+                float g = channels >= 3 ? fmin(fmax(px[1], 0.0f), 1.0f) : r;
+                float b = channels >= 3 ? fmin(fmax(px[2], 0.0f), 1.0f) : r;
+                float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+
+                atomic_inc(&histograms[bin_pixel(y, HISTOGRAM_BINS)]);
+                atomic_inc(&histograms[SCOPE_RGB_OFFSET +
+                                       bin_pixel(r, HISTOGRAM_BINS)]);
+                atomic_inc(&histograms[SCOPE_RGB_OFFSET + HISTOGRAM_BINS +
+                                       bin_pixel(g, HISTOGRAM_BINS)]);
+                atomic_inc(&histograms[SCOPE_RGB_OFFSET + 2 * HISTOGRAM_BINS +
+                                       bin_pixel(b, HISTOGRAM_BINS)]);
+
+                uint x = (first_pixel + p) % width;
+                uint column = x * WAVEFORM_COLUMNS / width;
+                atomic_inc(&scopes[SCOPE_WAVEFORM_OFFSET +
+                                   bin_pixel(y, WAVEFORM_LEVELS) *
+                                       WAVEFORM_COLUMNS + column]);
+
+                float cb = (b - y) / 1.8556f + 0.5f;
+                float cr = (r - y) / 1.5748f + 0.5f;
+                atomic_inc(&scopes[SCOPE_VECTORSCOPE_OFFSET +
+                                   bin_pixel(cr, VECTORSCOPE_SIZE) *
+                                       VECTORSCOPE_SIZE +
+                                   bin_pixel(cb, VECTORSCOPE_SIZE)]);
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            // Final reduction of this group's histograms
+            for (uint i = get_local_id(0); i < SCOPE_WAVEFORM_OFFSET;
+                 i += get_local_size(0)) {
+                if (histograms[i] != 0) {
+                    atomic_add(&scopes[i], histograms[i]);
+                }
+            }
+        }
+    )";
+}
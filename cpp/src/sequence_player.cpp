@@ -0,0 +1,392 @@
+#include "sequence_player.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "cpu_backend.h"
+
+namespace fs = std::filesystem;
+
+static const char* const DIGITS = "0123456789";
+
+// The frame number is the last run of digits in the file name: sets
+// [begin, end) to its position in `stem`, or returns false if there is none
+static bool find_frame_number(const std::string& stem, size_t& begin,
+                              size_t& end) {
+    size_t last = stem.find_last_of(DIGITS);
+    if (last == std::string::npos) {
+        return false;
+    }
+    begin = stem.find_last_not_of(DIGITS, last);
+    begin = begin == std::string::npos ? 0 : begin + 1;
+    end = last + 1;
+    return true;
+}
+
+// -1 for a run of digits too long to be a frame number
+static long long parse_frame_number(const std::string& digits) {
+    try {
+        return std::stoll(digits);
+    } catch (const std::out_of_range&) {
+        return -1;
+    }
+}
+
+std::vector<std::string> find_sequence_frames(const std::string& first_frame) {
+    fs::path first(first_frame);
+    std::string stem = first.stem().string();
+    std::string extension = first.extension().string();
+
+    size_t number_begin;
+    size_t number_end;
+    if (!find_frame_number(stem, number_begin, number_end) ||
+        parse_frame_number(stem.substr(
+            number_begin, number_end - number_begin)) < 0) {
+        return {first_frame};
+    }
+    std::string prefix = stem.substr(0, number_begin);
+    std::string suffix = stem.substr(number_end);
+
+    fs::path directory = first.has_parent_path() ? first.parent_path() : ".";
+    // A directory that can't be listed leaves just the first frame, which
+    // then fails to open like any other missing frame
+    std::error_code error;
+    fs::directory_iterator entries(directory, error);
+    if (error) {
+        return {first_frame};
+    }
+    std::vector<std::pair<long long, std::string>> frames;
+    for (; entries != fs::directory_iterator(); entries.increment(error)) {
+        if (error) {
+            break;
+        }
+        const fs::directory_entry& entry = *entries;
+        if (!entry.is_regular_file(error) ||
+            entry.path().extension().string() != extension) {
+            continue;
+        }
+        std::string name = entry.path().stem().string();
+        if (name.size() <= prefix.size() + suffix.size() ||
+            name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(),
+                         suffix) != 0) {
+            continue;
+        }
+        std::string number = name.substr(
+            prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (number.find_first_not_of(DIGITS) != std::string::npos) {
+            continue;
+        }
+        long long frame = parse_frame_number(number);
+        if (frame >= 0) {
+            frames.emplace_back(frame, entry.path().string());
+        }
+    }
+    std::sort(frames.begin(), frames.end());
+
+    std::vector<std::string> paths;
+    paths.reserve(frames.size());
+    for (auto& frame : frames) {
+        paths.push_back(std::move(frame.second));
+    }
+    return paths;
+}
+
+long long sequence_frame_number(const std::string& path) {
+    std::string stem = fs::path(path).stem().string();
+    size_t number_begin;
+    size_t number_end;
+    if (!find_frame_number(stem, number_begin, number_end)) {
+        return -1;
+    }
+    return parse_frame_number(
+        stem.substr(number_begin, number_end - number_begin));
+}
+
+SequencePlayer::SequencePlayer(std::vector<std::string> frame_paths,
+                               int new_width, float fps, size_t ring_size,
+                               unsigned int workers, FrameProcessor process)
+    : frame_paths(std::move(frame_paths)),
+      new_width(new_width),
+      frame_period(1.0 / fps),
+      process(std::move(process)),
+      ring(ring_size),
+      anchor_time(Clock::now()) {
+    if (this->frame_paths.empty()) {
+        throw std::runtime_error("SequencePlayer: the sequence has no frames");
+    }
+    if (fps <= 0.0f || ring_size == 0) {
+        throw std::runtime_error(
+            "SequencePlayer: fps and ring size must be positive");
+    }
+    // Leave half of the cores to the UI and the processing backend
+    if (workers == 0) {
+        workers = std::max(1u, cpu_thread_count() / 2);
+    }
+    for (unsigned int i = 0; i < workers; ++i) {
+        this->workers.emplace_back(&SequencePlayer::worker_loop, this);
+    }
+}
+
+SequencePlayer::~SequencePlayer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int SequencePlayer::wrap(long long frame) const {
+    long long count = static_cast<long long>(frame_paths.size());
+    return static_cast<int>((frame % count + count) % count);
+}
+
+long long SequencePlayer::elapsed_steps(Clock::time_point now) const {
+    if (!playing) {
+        return 0;
+    }
+    return static_cast<long long>(
+        std::floor((now - anchor_time) / frame_period));
+}
+
+int SequencePlayer::playhead(Clock::time_point now) const {
+    return wrap(anchor_frame + direction * elapsed_steps(now));
+}
+
+void SequencePlayer::play(int new_direction) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    anchor_frame = playhead(now);
+    anchor_time = now;
+    direction = new_direction < 0 ? -1 : 1;
+    playing = true;
+    work_ready.notify_all();
+}
+
+void SequencePlayer::pause() {
+    std::lock_guard<std::mutex> lock(mutex);
+    anchor_frame = playhead(Clock::now());
+    playing = false;
+}
+
+void SequencePlayer::seek(int frame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    anchor_frame = wrap(frame);
+    anchor_time = Clock::now();
+    // A jump is not a run of dropped frames
+    scrubbed = true;
+    work_ready.notify_all();
+}
+
+bool SequencePlayer::is_playing() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return playing;
+}
+
+int SequencePlayer::frame_count() const {
+    return static_cast<int>(frame_paths.size());
+}
+
+size_t SequencePlayer::window_size() const {
+    return std::min(ring.size(), frame_paths.size());
+}
+
+bool SequencePlayer::in_window(int frame, int head) const {
+    return static_cast<size_t>(wrap(
+               static_cast<long long>(frame - head) * direction)) <
+           window_size();
+}
+
+int SequencePlayer::find_slot(int frame) const {
+    for (size_t i = 0; i < ring.size(); ++i) {
+        if (ring[i].frame == frame && ring[i].state != SlotState::Empty) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+int SequencePlayer::free_slot(int head) const {
+    int reusable = -1;
+    for (size_t i = 0; i < ring.size(); ++i) {
+        const Slot& slot = ring[i];
+        if (slot.state == SlotState::Empty) {
+            return static_cast<int>(i);
+        }
+        if (slot.state == SlotState::Ready && !in_window(slot.frame, head)) {
+            reusable = static_cast<int>(i);
+        }
+    }
+    return reusable;
+}
+
+bool SequencePlayer::claim_frame(Clock::time_point now, int& frame,
+                                 int& slot_index) {
+    long long steps = elapsed_steps(now);
+    int head = playhead(now);
+    std::chrono::duration<double, std::milli> expected_ms(
+        totals.frames_decoded > 0
+            ? (total_decode_ms + total_process_ms) / totals.frames_decoded
+            : 0.0);
+
+    // Any slot can hold any frame, so a window that wraps around the loop
+    // point never maps two of its frames onto one slot
+    int target = free_slot(head);
+    if (target < 0) {
+        return false;
+    }
+
+    // Walk the window ahead of the playhead. While playing, a frame that
+    // can't be ready before its successor is due would never be shown, so
+    // it is skipped; if every frame is that late, take the farthest one.
+    int fallback = -1;
+    for (size_t k = 0; k < window_size(); ++k) {
+        int candidate = wrap(head + direction * static_cast<long long>(k));
+        if (find_slot(candidate) >= 0) {
+            continue;
+        }
+        if (playing) {
+            auto obsolete_at =
+                anchor_time +
+                frame_period * static_cast<double>(steps + k + 1);
+            if (now + expected_ms >= obsolete_at) {
+                fallback = candidate;
+                continue;
+            }
+        }
+        fallback = candidate;
+        break;
+    }
+    if (fallback < 0) {
+        return false;
+    }
+
+    Slot& slot = ring[target];
+    slot.frame = fallback;
+    slot.state = SlotState::Decoding;
+    slot.image.reset();
+    frame = fallback;
+    slot_index = target;
+    return true;
+}
+
+void SequencePlayer::rescale_to_sequence(
+    ImageData& image, std::unique_lock<std::mutex>& lock) {
+    lock.lock();
+    if (sequence_scale <= 0.0f) {
+        sequence_scale = image.normalization_scale;
+    }
+    float scale = sequence_scale;
+    lock.unlock();
+
+    // Undo the frame's own normalization and apply the sequence's
+    float factor = image.normalization_scale / scale;
+    if (factor != 1.0f) {
+        for (float& value : image.pixels) {
+            value *= factor;
+        }
+        image.normalization_scale = scale;
+    }
+}
+
+void SequencePlayer::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        int frame;
+        int slot_index;
+        if (!claim_frame(Clock::now(), frame, slot_index)) {
+            // Nothing to do until the playhead moves or someone seeks
+            work_ready.wait_for(lock, frame_period);
+            continue;
+        }
+        std::string path = frame_paths[frame];
+        lock.unlock();
+
+        // [01] Decode and preprocess outside the lock
+        Clock::time_point start = Clock::now();
+        std::shared_ptr<ImageData> image;
+        Clock::time_point decoded = start;
+        try {
+            image =
+                std::make_shared<ImageData>(scanline_image(path, new_width));
+            decoded = Clock::now();
+            if (image->hasDynamicRangeData()) {
+                rescale_to_sequence(*image, lock);
+            }
+            if (process && !image->pixels.empty()) {
+                process(*image);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to load frame " << path << ": " << e.what()
+                      << std::endl;
+            image = std::make_shared<ImageData>();
+        }
+        Clock::time_point done = Clock::now();
+
+        // [02] Publish; the Decoding state kept the slot reserved for us
+        lock.lock();
+        Slot& slot = ring[slot_index];
+        slot.image = std::move(image);
+        slot.state = SlotState::Ready;
+        totals.frames_decoded++;
+        total_decode_ms +=
+            std::chrono::duration<double, std::milli>(decoded - start).count();
+        total_process_ms +=
+            std::chrono::duration<double, std::milli>(done - decoded).count();
+    }
+}
+
+std::optional<PlaybackFrame> SequencePlayer::current_frame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    int head = playhead(Clock::now());
+    int slot_index = find_slot(head);
+    if (slot_index >= 0 && ring[slot_index].state == SlotState::Ready) {
+        const Slot& slot = ring[slot_index];
+        if (head != last_shown) {
+            // Every step between the last shown frame and this one was due
+            // and never displayed
+            if (last_shown >= 0 && playing && !scrubbed) {
+                int steps = wrap(static_cast<long long>(head - last_shown) *
+                                 direction);
+                if (steps > 1) {
+                    totals.frames_dropped += steps - 1;
+                }
+            }
+            totals.frames_shown++;
+            scrubbed = false;
+            last_shown = head;
+            last_image = slot.image;
+            // The window moved: its far end is free to decode
+            work_ready.notify_all();
+        }
+        return PlaybackFrame{head, slot.image};
+    }
+    if (last_image) {
+        return PlaybackFrame{last_shown, last_image};
+    }
+    return std::nullopt;
+}
+
+PlaybackStats SequencePlayer::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    PlaybackStats result = totals;
+    result.frames_buffered = static_cast<size_t>(
+        std::count_if(ring.begin(), ring.end(), [](const Slot& slot) {
+            return slot.state == SlotState::Ready;
+        }));
+    if (totals.frames_decoded > 0) {
+        result.average_decode_ms = total_decode_ms / totals.frames_decoded;
+        result.average_process_ms = total_process_ms / totals.frames_decoded;
+    }
+    return result;
+}
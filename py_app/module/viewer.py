@@ -42,6 +42,7 @@ else:
 import hdr_viewer_cpp as hdr_viewer
 
 WIDTH = 1024
+SCOPE_HEIGHT = 128
 
 
 def format_dynamic_range(dynamic_range):
@@ -62,6 +63,7 @@ class ImageViewer(QWidget):
         super().__init__()
         self.image_path = image_path
         self.original_image_data = None
+        self.scopes = None
         self.image_processor = hdr_viewer.ImageProcessor()
         self.init_ui()
         if self.image_path:
@@ -97,6 +99,27 @@ class ImageViewer(QWidget):
         self.exposure_value = 0.0
         self.exposure_label = QLabel("Exposure: 0", self)
 
+        # Local tone mapping widgets: 0 leaves the image untouched, 100
+        # compresses the base layer to a quarter of its range in stops
+        self.local_tone_slider = QSlider(Qt.Horizontal, self)
+        self.local_tone_slider.setMinimum(0)
+        self.local_tone_slider.setMaximum(100)
+        self.local_tone_slider.setValue(0)
+        self.local_tone_compression = 1.0
+        self.local_tone_label = QLabel("Local tone: 0", self)
+
+        # Scopes of the displayed image, redrawn with it
+        self.histogram_label = QLabel(self)
+        self.histogram_label.setFixedSize(
+            2 * hdr_viewer.HISTOGRAM_BINS, SCOPE_HEIGHT
+        )
+        self.histogram_label.setToolTip("RGB histogram")
+        self.waveform_label = QLabel(self)
+        self.waveform_label.setFixedSize(
+            2 * hdr_viewer.WAVEFORM_COLUMNS, SCOPE_HEIGHT
+        )
+        self.waveform_label.setToolTip("Luma waveform")
+
     def _setup_layout(self):
         gamma_layout = QHBoxLayout()
         gamma_layout.addWidget(self.gamma_label)
@@ -106,18 +129,29 @@ class ImageViewer(QWidget):
         exposure_layout.addWidget(self.exposure_label)
         exposure_layout.addWidget(self.exposure_slider)
 
+        local_tone_layout = QHBoxLayout()
+        local_tone_layout.addWidget(self.local_tone_label)
+        local_tone_layout.addWidget(self.local_tone_slider)
+
         layout = QVBoxLayout(self)
         layout.addWidget(self.load_button)
         layout.addWidget(self.info_label)
         layout.addLayout(gamma_layout)
         layout.addLayout(exposure_layout)
+        layout.addLayout(local_tone_layout)
         layout.addWidget(self.view)
+
+        scopes_layout = QHBoxLayout()
+        scopes_layout.addWidget(self.histogram_label)
+        scopes_layout.addWidget(self.waveform_label)
+        layout.addLayout(scopes_layout)
         self.setLayout(layout)
 
     def _connect_signals(self):
         self.load_button.clicked.connect(self.open_image_dialog)
         self.gamma_slider.valueChanged.connect(self.update_gamma)
         self.exposure_slider.valueChanged.connect(self.update_exposure)
+        self.local_tone_slider.valueChanged.connect(self.update_local_tone)
 
     def load_image(self, fname):
         self.original_image_data = hdr_viewer.scanline_image(fname, WIDTH)
@@ -157,11 +191,78 @@ class ImageViewer(QWidget):
         self.exposure_label.setText(f"Exposure: {self.exposure_value:.1f}")
         self.compute_exposure_gamma(self.exposure_value, self.inv_gamma)
 
+    def update_local_tone(self):
+        amount = self.local_tone_slider.value()
+        self.local_tone_label.setText(f"Local tone: {amount}")
+        self.local_tone_compression = 1.0 - 0.75 * amount / 100.0
+        self.compute_exposure_gamma(self.exposure_value, self.inv_gamma)
+
     def compute_exposure_gamma(self, *args):
-        processed_image_data = self.image_processor.apply_exposure_gamma_correction(
-            self.original_image_data.pixels, *args
+        pixels = self.original_image_data.pixels
+        if self.local_tone_compression < 1.0:
+            pixels = self.image_processor.apply_local_tone_mapping(
+                pixels,
+                self.original_image_data.resized_width,
+                self.original_image_data.resized_height,
+                self.original_image_data.num_output_channels,
+                self.local_tone_compression,
+                1.0,
+            )
+        # Scopes come from the same pass, so they refresh on every slider tick
+        processed_image_data, self.scopes = (
+            self.image_processor.apply_exposure_gamma_scopes(
+                pixels,
+                self.original_image_data.resized_width,
+                self.original_image_data.resized_height,
+                self.original_image_data.num_output_channels,
+                *args,
+            )
         )
         self.display_image(processed_image_data)
+        self.display_scopes()
+
+    def display_scopes(self):
+        if self.scopes is None:
+            return
+        bins = hdr_viewer.HISTOGRAM_BINS
+        rows = np.arange(SCOPE_HEIGHT)[:, None]
+
+        # R, G and B histograms overlaid, each scaled to its own peak
+        histogram = np.zeros((SCOPE_HEIGHT, bins, 3), dtype=np.uint8)
+        rgb = np.array(self.scopes.rgb_histogram, dtype=np.float64).reshape(
+            3, bins
+        )
+        for channel in range(3):
+            peak = max(rgb[channel].max(), 1.0)
+            heights = (rgb[channel] / peak * SCOPE_HEIGHT).astype(np.int64)
+            histogram[..., channel] = np.where(
+                rows >= SCOPE_HEIGHT - heights[None, :], 220, 0
+            )
+        self._set_scope_pixmap(
+            self.histogram_label, histogram, QImage.Format_RGB888
+        )
+
+        # Waveform: log-scaled counts, white at the top
+        levels = hdr_viewer.WAVEFORM_LEVELS
+        columns = hdr_viewer.WAVEFORM_COLUMNS
+        counts = np.array(self.scopes.waveform, dtype=np.float64).reshape(
+            levels, columns
+        )[::-1]
+        peak = max(np.log1p(counts).max(), 1.0)
+        waveform = (np.log1p(counts) / peak * 255).astype(np.uint8)
+        self._set_scope_pixmap(
+            self.waveform_label, waveform, QImage.Format_Grayscale8
+        )
+
+    def _set_scope_pixmap(self, label, pixels, image_format):
+        pixels = np.ascontiguousarray(pixels)
+        h, w = pixels.shape[:2]
+        q_img = QImage(pixels.tobytes(), w, h, pixels.strides[0], image_format)
+        label.setPixmap(
+            QPixmap(q_img).scaled(
+                label.width(), label.height(), Qt.IgnoreAspectRatio
+            )
+        )
 
     def display_image(self, img_data):
         img_data_np = np.array(img_data)